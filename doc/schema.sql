@@ -1,12 +1,41 @@
+-- Verdict cache of the MySQL backend. Entries are keyed by the binary MD5
+-- digest of their URL; the URL itself is kept for diagnostics only. Status
+-- and decision hold the numbers of InfernoConf::Status and
+-- InfernoConf::Classification. Tables of earlier layouts are converted
+-- with scripts/migrateSchema.sh.
+--
+-- An entry is written here once, when its verdict is final; until then it
+-- lives in the jobs table below. Entries past the retention period
+-- (inferno.CacheRetention) are removed oldest first, through the index on
+-- their modification time.
 CREATE TABLE cache
 (
-	id bigint auto_increment not null,
-	hash char(32) unique not null,
-	url longtext not null,
-	decision enum('PORN', 'BENIGN', 'BIKINI', 'UNDEFINED') not null,
-	ctype mediumtext not null,
-	status enum('FETCHING', 'PROCESSING', 'FETCHING_MORE', 'CLASSIFYING', 'DONE', 'FAILURE') not null,
-	primary key(id),
-	unique index (url(1000)) using hash,
-	unique index (hash) using hash
-) engine=myisam;
+	hash binary(16) not null,
+	url text not null,
+	decision tinyint unsigned not null,
+	ctype varchar(255) not null default '',
+	status tinyint unsigned not null,
+	failures int unsigned not null default 0,
+	reason varchar(255) not null default '',
+	retry_after datetime null default null,
+	modified timestamp not null default current_timestamp on update current_timestamp,
+	primary key(hash),
+	key(modified)
+) engine=innodb;
+
+-- Entries being fetched or classified, named after the verdict table with
+-- a '_jobs' suffix. Its contents are lost on a server restart, which only
+-- makes InFeRno fetch those entries anew. Rows are of fixed length in a
+-- MEMORY table, so max_heap_table_size bounds the number of entries in
+-- progress (about 7000 per 16MB).
+CREATE TABLE cache_jobs
+(
+	hash binary(16) not null,
+	url varbinary(2048) not null default '',
+	decision tinyint unsigned not null,
+	ctype varbinary(255) not null default '',
+	status tinyint unsigned not null,
+	modified timestamp not null default current_timestamp on update current_timestamp,
+	ins_token bigint unsigned not null default 0,
+	primary key(hash)
+) engine=memory;
@@ -0,0 +1,81 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_CSSPARSE_H__
+#define __MY_CSSPARSE_H__
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <libcroco/libcroco.h>
+
+#include "config.h"
+
+/**
+ * Extracts the images referenced by the background properties of a
+ * stylesheet. Also keeps a process-wide cache of the images of every
+ * stylesheet seen, as most pages of a site share the same stylesheets.
+ */
+class CSSParser {
+	public:
+		/**
+		 * Stylesheets larger than this (in bytes) are not looked into.
+		 */
+		const static size_t MAX_SIZE;
+
+	private:
+		/**
+		 * Upper bound on the number of stylesheets kept in the cache.
+		 */
+		const static size_t MAX_ENTRIES;
+
+		class Context {
+			public:
+				std::set<std::string>* url_list;
+				std::string base_url;
+		};
+
+		struct Entry {
+			std::vector<std::string> images;
+			time_t expires;
+		};
+
+		static std::map<std::string, Entry> entries;
+		static pthread_mutex_t lock;
+
+		static void Property(CRDocHandler *handler, CRString *name, CRTerm *expression, gboolean important);
+		static void prune(time_t now);
+
+	public:
+		static void parseCss(const std::string& css, const std::string& baseUrl, std::set<std::string>& url_list);
+		static void parseCssFile(const std::string& cssPath, const std::string& baseUrl, std::set<std::string>& url_list);
+		static void parseStyle(const std::string& style, const std::string& baseUrl, std::set<std::string>& url_list);
+
+		static bool lookup(const std::string& url, std::set<std::string>& url_list);
+		static void store(const std::string& url, const std::set<std::string>& images, long ttl);
+};
+
+#endif
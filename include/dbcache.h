@@ -22,56 +22,85 @@
 #ifndef __MY_DBCACHE_H__
 #define __MY_DBCACHE_H__
 
+#include <ctime>
 #include <iostream>
-#include <mysql.h>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "infernoconf.h"
 #include "config.h"
 
+/**
+ * The state of a cache entry, as returned by a single lookup.
+ */
+struct UrlRecord {
+	InfernoConf::Status status;
+	InfernoConf::Classification decision;
+	std::string ctype;
+	unsigned int failures;
+	time_t modified;		/* last change of the entry */
+	time_t retry_after;		/* end of the back-off period, or 0 */
+};
+
+/**
+ * Client of the verdict store shared by srv_inferno and sead. Entries are
+ * keyed by the MD5 hash of their URL; the store itself is one of the
+ * backends of InfernoConf::CacheBackend (see create()).
+ */
 class DbCache {
-	private:
-		/* MySQL-related data structures */
-		MYSQL *conn;
-		bool mysql_connected;
+	protected:
 		InfernoConf dbConf;
 
-		int checkAndCreateDir(const char *);
-		int makeSpoolQueue();
+		/** Length of the binary form of a hash */
+		const static int HASH_BYTES = 16;
+
+		static bool hashBytes(const std::string& hash, unsigned char *key);
 
 	public:
-		DbCache();
-		~DbCache();
+		virtual ~DbCache();
+
+		static DbCache* create(const InfernoConf& conf);
 
-		int init(const InfernoConf&);
+		virtual int init(const InfernoConf&);
 		int init();
 
 		/* connection status checking */
-		int isConnectionAlive();
-		int reconnect(int times=1);
+		virtual int reconnect(int times=1) = 0;
 
 		/* error handling */
-		int getErrorCode();
-		char* getErrorString();
+		virtual int getErrorCode() = 0;
+		virtual char* getErrorString() = 0;
 
 		/* general convenience functions */
+		static std::string hashUrl(const std::string& url);
 		std::string* makeHashByurl(const std::string& url);
 		InfernoConf getInfernoConf();
+		virtual void setInfernoConf(const InfernoConf& conf);
 		
 		/* cache I/O functions */
-		int updateUrlStatus(const std::string& hash, InfernoConf::Status status);
-		int updateUrlClassification(const std::string& hash, InfernoConf::Classification classification);
-		int updateUrlContentType(const std::string& hash, const std::string& ctype);
-		int insertUrlEntry(const std::string& url, std::string& hash);
-
-		InfernoConf::Classification lookupUrlClassification(const std::string& hash);
-		InfernoConf::Status lookupUrlStatus(const std::string& hash);
-		std::string lookupUrlContentType(const std::string& hash);
+		virtual int updateUrlStatus(const std::string& hash, InfernoConf::Status status) = 0;
+		virtual int updateUrlClassification(const std::string& hash, InfernoConf::Classification classification) = 0;
+		virtual int updateUrlContentType(const std::string& hash, const std::string& ctype) = 0;
+		virtual int updateUrlFailure(const std::string& hash, const std::string& reason) = 0;
+		virtual int insertUrlEntry(const std::string& url, std::string& hash) = 0;
+		virtual int insertUrlEntries(const std::vector<std::string>& urls, std::vector<std::string>& hashes, std::vector<int>& results);
+		virtual int removeUrlEntry(const std::string& hash) = 0;
+		virtual int renewUrlVerdict(const std::string& hash) = 0;
+
+		virtual InfernoConf::Classification lookupUrlClassification(const std::string& hash);
+		virtual InfernoConf::Status lookupUrlStatus(const std::string& hash);
+		virtual std::string lookupUrlContentType(const std::string& hash);
+		virtual int lookupUrlRecord(const std::string& hash, UrlRecord& record) = 0;
+		virtual int lookupUrlRecords(const std::set<std::string>& hashes, std::map<std::string, UrlRecord>& records);
 		
-		int fixCache();
+		virtual int fixCache() = 0;
+		virtual int expireUrlEntries(long age, size_t limit, bool& more) = 0;
+		virtual int staleUrlEntries(long age, size_t limit, std::vector<std::string>& hashes) = 0;
 
 		/* basic operations  */
-		int connect();
-		void cleanup();
+		virtual int connect() = 0;
+		virtual void cleanup() = 0;
 };
 
 #endif
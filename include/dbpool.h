@@ -0,0 +1,68 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_DBPOOL_H__
+#define __MY_DBPOOL_H__
+
+#include <vector>
+
+#include <pthread.h>
+
+#include "dbcache.h"
+#include "infernoconf.h"
+#include "config.h"
+
+/**
+ * Process-wide pool of persistent cache server connections. A connection
+ * is checked out for the duration of a logical operation (such as serving
+ * a request) and returned to the pool afterwards, instead of a new one
+ * being set up every time.
+ */
+class DbPool {
+	private:
+		/**
+		 * Upper bound on the number of idle connections kept open.
+		 */
+		const static size_t MAX_IDLE;
+
+		static std::vector<DbCache*> idle;
+		static pthread_mutex_t lock;
+
+		/**
+		 * Marks the threads the MySQL client library has been set up for,
+		 * so that it is set up once per thread and torn down on its exit.
+		 */
+		static pthread_key_t thread_key;
+		static pthread_once_t key_once;
+
+		static bool sameServer(const InfernoConf& a, const InfernoConf& b);
+		static void makeKey();
+		static void endThread(void *arg);
+		static void initThread();
+
+	public:
+		static DbCache* checkout(const InfernoConf& conf);
+		static void checkin(DbCache *cache);
+		static void clear();
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_DNSCACHE_H__
+#define __MY_DNSCACHE_H__
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include "config.h"
+
+/**
+ * Process-wide cache of resolved host addresses. Hosts are resolved in the
+ * background as soon as they are discovered on a page, so that transfers
+ * started later on can skip the resolver altogether.
+ */
+class DnsCache {
+	private:
+		/**
+		 * Upper bound on the number of resolver threads running at any
+		 * time, and on the number of hosts kept in the cache.
+		 */
+		const static int MAX_RESOLVERS;
+		const static size_t MAX_ENTRIES;
+
+		struct Entry {
+			std::vector<std::string> addrs;
+			time_t expires;
+			bool pending;
+		};
+
+		struct Job {
+			std::string host;
+			long ttl;
+		};
+
+		static std::map<std::string, Entry> entries;
+		static pthread_mutex_t lock;
+		static int resolvers;
+
+		static void* resolve(void *arg);
+		static void prune(time_t now);
+
+	public:
+		static bool splitUrl(const std::string& url, std::string& host, std::string& port);
+		static void prefetch(const std::set<std::string>& urls, long ttl);
+		static bool lookup(const std::string& host, std::vector<std::string>& addrs);
+		static struct curl_slist* resolveList(const std::string& url, struct curl_slist* list, int rotate = 0);
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_FETCHSTATS_H__
+#define __MY_FETCHSTATS_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "config.h"
+
+/**
+ * Process-wide statistics on image transfers, shared by all requests
+ * served by the process. Also drives the transfer concurrency window,
+ * which grows additively while transfers go well and shrinks by half on
+ * timeouts, throttling or inflated server latency (AIMD). Latency is
+ * judged against the baseline of each origin server, and the window
+ * stops growing once throughput no longer grows along with it.
+ */
+class FetchStats {
+	public:
+		enum Outcome {OUTCOME_NEUTRAL, OUTCOME_OK, OUTCOME_CONGESTED};
+
+	private:
+		/**
+		 * Number of most recent transfer durations kept, and minimum number
+		 * of them required before percentiles are deemed meaningful.
+		 */
+		const static size_t SAMPLES;
+		const static size_t MIN_SAMPLES;
+
+		/**
+		 * Initial and maximum size of the transfer window, when the latter
+		 * is not bounded by the configuration.
+		 */
+		const static double INITIAL_WINDOW;
+		const static double MAX_WINDOW;
+
+		/**
+		 * Smoothed server latency over this many times its baseline is taken
+		 * as a sign of congestion.
+		 */
+		const static double LATENCY_INFLATION;
+
+		/**
+		 * Number of origin servers whose latency is tracked at most, and
+		 * seconds after which an idle one is forgotten.
+		 */
+		const static size_t MAX_ORIGINS;
+		const static double ORIGIN_TTL;
+
+		/**
+		 * Interval (in seconds) over which throughput is sampled, and gain
+		 * in throughput a window twice as large must bring for the window
+		 * to keep growing.
+		 */
+		const static double RATE_INTERVAL;
+		const static double RATE_GAIN;
+
+		/**
+		 * Interval (in seconds) between window reports in the log.
+		 */
+		const static double REPORT_INTERVAL;
+
+		static std::vector<double> durations;
+		static size_t next;
+		static long transfers;
+		static long hedges;
+		static double window;
+		static double ssthresh;
+		static long inflight;
+		class Origin {
+			public:
+				double base_latency;
+				double srtt;
+				double used;
+		};
+
+		static std::map<std::string, Origin> origins;
+		static double srtt;
+		static double rate_start;
+		static double rate_bytes;
+		static double best_rate;
+		static double best_window;
+		static double last_cut;
+		static double last_report;
+		static long early_verdicts;
+		static double bytes_saved;
+		static double bytes_fetched;
+		static pthread_mutex_t lock;
+
+		static void cutWindow(double now);
+		static bool inflated(const std::string& origin, double latency, double now);
+		static void sampleRate(double now);
+
+	public:
+		static double now();
+		static void recordTransfer();
+		static void recordFetch(double secs);
+		static bool percentile(long pct, double& value);
+		static bool acquireHedge(long ratio);
+		static bool acquireSlot(long max, bool force);
+		static void releaseSlot(Outcome outcome, double latency, const std::string& origin = "");
+		static void recordEarlyVerdict(double saved);
+		static void recordBytes(size_t len);
+		static double getBytes();
+		static double getWindow();
+		static long getInflight();
+};
+
+#endif
@@ -24,6 +24,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include <libxml/HTMLparser.h>
 
@@ -35,19 +36,47 @@ class HTMLParser {
 		const static char *ximg_cts_ext[];
 		const static htmlSAXHandler saxHandler;
 
+		/**
+		 * An image variant offered by a page, along with its width in pixels
+		 * (0 if unknown).
+		 */
+		class Candidate {
+			public:
+				std::string url;
+				long width;
+		};
+
 		class Context {
 			public:
 				int x;
 				std::set<std::string>* url_list;
 				std::string global_base_prefix;
+				long min_width;
+				bool in_picture;
+				std::vector<Candidate> sources; // variants offered by the <source>s of the current <picture>
+				std::set<std::string>* link_list; // same-site links of the page, if wanted
+				std::string host;
+				std::set<std::string>* css_list; // linked stylesheets, if wanted
+				bool in_style;
+				std::string style; // contents of the current <style>
 		};
 
 		static void StartElement(void *voidContext, const xmlChar *name, const xmlChar **attributes);
 		static void EndElement(void *voidContext, const xmlChar *name);
+		static void Characters(void *voidContext, const xmlChar *chars, int len);
+
+		static const char* getAttribute(const xmlChar **attributes, const char *name);
+		static bool hasAttribute(const xmlChar **attributes, const char *name);
+		static bool isSupportedType(const char *type);
+		static long parseSizes(const char *sizes);
+		static void parseSrcset(const Context *ctx, const char *srcset, long slot, std::vector<Candidate>& candidates);
+		static std::string pickCandidate(const std::vector<Candidate>& candidates, long min_width);
+		static void addLink(Context *ctx, const xmlChar **attributes);
 
 	public:
 		static std::string recompose_url(const std::string& baseUrl, const std::string& relativeUrl);
-		static void parseHtml(const std::string&, const std::string&, std::set<std::string>&);
+		static std::string hostOf(const std::string& url);
+		static void parseHtml(const std::string&, const std::string&, std::set<std::string>&, long min_width, std::set<std::string>* link_list = NULL, std::set<std::string>* css_list = NULL);
 };
 
 #endif
@@ -0,0 +1,75 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_HTTPARCHIVE_H__
+#define __MY_HTTPARCHIVE_H__
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "config.h"
+
+/**
+ * Archive of recorded origin responses, one file per URL in a directory,
+ * for reproducible runs of the fetch path without network access.
+ */
+class HttpArchive {
+	public:
+		class Record {
+			public:
+				std::string url;
+				long status;
+				double ttfb;  // time to first byte, in seconds
+				double total; // total transfer time, in seconds
+				std::vector<std::string> headers;
+				std::string body;
+
+				Record() : status(0), ttfb(0), total(0) {}
+		};
+
+		static std::string key(const std::string& url);
+		static int store(const std::string& dir, const Record& rec);
+		static int load(const std::string& dir, const std::string& key, Record& rec);
+};
+
+/**
+ * Loopback HTTP server replaying the responses of an HttpArchive, along
+ * with their recorded delays. Requests are for /<key> of the original URL.
+ */
+class ReplayServer {
+	private:
+		static std::string dir;
+		static long port;
+		static bool started;
+		static pthread_mutex_t lock;
+
+		static void* acceptLoop(void *arg);
+		static void* serve(void *arg);
+
+	public:
+		static int start(const std::string& dir, long port);
+		static std::string rewrite(const std::string& url);
+};
+
+#endif
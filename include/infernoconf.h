@@ -32,6 +32,32 @@ class InfernoConf {
 			F_MODE_MIXED
 		};
 
+		/**
+		 * Origin responses can be recorded to, or replayed from, an archive
+		 * (see HttpArchive) for reproducible runs of the fetch path.
+		 */
+		enum ArchiveMode {
+			ARCHIVE_OFF,
+			ARCHIVE_RECORD,
+			ARCHIVE_REPLAY
+		};
+
+		/**
+		 * Verdicts are kept either in a MySQL table, shared by all hosts
+		 * using it, or in an embedded store shared by the processes of a
+		 * single host (see DbCache).
+		 */
+		enum CacheBackend {
+			BACKEND_MYSQL,
+			BACKEND_LOCAL
+		};
+
+		/**
+		 * Bounds of the spool fan-out (see SPOOL_LEVELS).
+		 */
+		const static long MAX_SPOOL_LEVELS;
+		const static long MAX_SPOOL_DIGITS;
+
 	private:
 		const static std::string CACHE_HOSTNAME;
 		const static std::string CACHE_STORE;
@@ -40,6 +66,18 @@ class InfernoConf {
 		const static std::string CACHE_PASSWD;
 		const static std::string CACHE_DIR;
 
+		/**
+		 * File of the embedded verdict store, and the number of entries it
+		 * holds at most.
+		 */
+		const static std::string LOCAL_STORE;
+		const static long LOCAL_SLOTS;
+
+		/**
+		 * Loopback port to replay archived responses on.
+		 */
+		const static long REPLAY_PORT;
+
 		/**
 		 * Limit on the number of redirection hops to follow, when the web
 		 * server returns a 301 or 302.
@@ -83,6 +121,92 @@ class InfernoConf {
 		 */
 		const static long ACC_THRESH;
 
+		/**
+		 * Number of seconds to refrain from re-fetching an object after its
+		 * first failed transfer. The back-off period doubles with every
+		 * consecutive failure, up to FAIL_BACKOFF_MAX seconds. A value of 0
+		 * disables negative caching (i.e., failed objects are re-fetched on
+		 * the next request).
+		 */
+		const static long FAIL_BACKOFF;
+		const static long FAIL_BACKOFF_MAX;
+
+		/**
+		 * Number of seconds for which to keep pre-resolved host addresses
+		 * in the process-wide DNS cache. A value of 0 disables
+		 * pre-resolution, leaving name resolution to libcurl.
+		 */
+		const static long DNS_CACHE_TTL;
+
+		/**
+		 * Hedging of slow image transfers: once a transfer takes longer than
+		 * the HEDGE_PERCENTILE-th percentile of recent transfer durations, a
+		 * second attempt is started and the first one to complete is kept.
+		 * Hedged attempts are limited to HEDGE_RATIO percent of all transfers.
+		 * A percentile of 0 disables hedging.
+		 */
+		const static long HEDGE_PERCENTILE;
+		const static long HEDGE_RATIO;
+
+		/**
+		 * Minimum width (in pixels) of an image variant for the classifier to
+		 * reach a verdict; the smallest variant offered by a page that is at
+		 * least this wide is fetched.
+		 */
+		const static long MIN_IMAGE_WIDTH;
+
+		/**
+		 * Early classification of progressive JPEGs: once PARTIAL_SCANS scans
+		 * of an image have arrived, they are classified on their own, and the
+		 * rest of the transfer is aborted if the classifier is at least
+		 * PARTIAL_CONFIDENCE percent sure of its verdict. A number of scans of 0
+		 * disables early classification.
+		 */
+		const static long PARTIAL_SCANS;
+		const static long PARTIAL_CONFIDENCE;
+
+		/**
+		 * Crawl-ahead of linked pages: up to PREFETCH_LINKS same-site links of
+		 * every page served are queued, and fetched and classified in the
+		 * background while the proxy is idle, at no more than PREFETCH_RATE
+		 * pages per minute. A number of links of 0 disables crawl-ahead.
+		 */
+		const static long PREFETCH_LINKS;
+		const static long PREFETCH_RATE;
+
+		/**
+		 * Time (in seconds) the images referenced by a stylesheet are cached
+		 * for, so that a stylesheet shared by the pages of a site is not
+		 * fetched and parsed for every page. A value of 0 disables the cache.
+		 */
+		const static long CSS_CACHE_TTL;
+
+		/**
+		 * Spool size (in bytes) above which the least recently used spool
+		 * files are evicted, size down to which they are, and age (in
+		 * seconds) past which spool files are evicted regardless. A value of
+		 * 0 disables the respective bound.
+		 */
+		const static long SPOOL_HIGH;
+		const static long SPOOL_LOW;
+		const static long SPOOL_MAX_AGE;
+
+		/**
+		 * Number of directory levels spool files are fanned out to, and number
+		 * of hex digits of the hash naming the directories of each level. The
+		 * default of one level of one digit makes for 16 directories.
+		 */
+		const static long SPOOL_LEVELS;
+		const static long SPOOL_DIGITS;
+
+		/**
+		 * Seconds a verdict is kept for after its last change (0 keeps it for
+		 * good), and number of entries and spool files the Reaper goes through
+		 * per second at most (0, the default, disables it).
+		 */
+		const static long CACHE_RETENTION;
+		const static long REAP_RATE;
+
 		/**
 		 * Filtering mode of inferno: a) image-level filtering (blurring out images
 		 * that are deemed as pornographic), b) page-wide
@@ -97,6 +221,9 @@ class InfernoConf {
 		std::string cache_uname;
 		std::string cache_passwd;
 		std::string cache_dir;
+		CacheBackend cache_backend;
+		std::string local_store;
+		long local_slots;
 
 		long redir_limit;
 		long conn_timeo;
@@ -105,7 +232,28 @@ class InfernoConf {
 		long low_speed_lim;
 		long low_speed_time;
 		long acc_thresh;
+		long fail_backoff;
+		long fail_backoff_max;
+		long dns_ttl;
+		long hedge_pct;
+		long hedge_ratio;
+		long min_width;
+		long partial_scans;
+		long partial_conf;
+		long prefetch_links;
+		long prefetch_rate;
+		long css_ttl;
+		long spool_high;
+		long spool_low;
+		long spool_max_age;
+		long spool_levels;
+		long spool_digits;
+		long cache_retention;
+		long reap_rate;
 		FilteringMode f_mode;
+		ArchiveMode archive_mode;
+		std::string archive_dir;
+		long replay_port;
 
 	public:
 		enum Classification {
@@ -136,20 +284,21 @@ class InfernoConf {
 			cache_host(CACHE_HOSTNAME), cache_store(CACHE_STORE),
 			cache_table(CACHE_TABLE), cache_uname(CACHE_UNAME),
 			cache_passwd(CACHE_PASSWD), cache_dir(CACHE_DIR),
+			cache_backend(BACKEND_MYSQL), local_store(LOCAL_STORE),
+			local_slots(LOCAL_SLOTS),
 			redir_limit(REDIR_LIMIT), conn_timeo(CONNECT_TIMEOUT),
 			max_xfers(MAX_CONC_XFERS), poll_interval(POLL_INTERVAL),
 			low_speed_lim(LOW_SPEED_LIMIT), low_speed_time(LOW_SPEED_TIME),
-			acc_thresh(ACC_THRESH), f_mode(FILTERING_MODE) {}
-
-		InfernoConf(
-				const std::string& ch, const std::string& cs, const
-				std::string& ct, const std::string& cu, const std::string& cp,
-				const std::string& cd, long rl, long cto, long mx, long pi,
-				long ll, long lt, long at, FilteringMode fm) :
-			cache_host(ch), cache_store(cs), cache_table(ct), cache_uname(cu),
-			cache_passwd(cp), cache_dir(cd), redir_limit(rl), conn_timeo(cto),
-			max_xfers(mx), poll_interval(pi), low_speed_lim(ll),
-			low_speed_time(lt), acc_thresh(at), f_mode(fm) {}
+			acc_thresh(ACC_THRESH), fail_backoff(FAIL_BACKOFF),
+			fail_backoff_max(FAIL_BACKOFF_MAX), dns_ttl(DNS_CACHE_TTL),
+			hedge_pct(HEDGE_PERCENTILE), hedge_ratio(HEDGE_RATIO),
+			min_width(MIN_IMAGE_WIDTH), partial_scans(PARTIAL_SCANS),
+			partial_conf(PARTIAL_CONFIDENCE), prefetch_links(PREFETCH_LINKS),
+			prefetch_rate(PREFETCH_RATE), css_ttl(CSS_CACHE_TTL), spool_high(SPOOL_HIGH),
+			spool_low(SPOOL_LOW), spool_max_age(SPOOL_MAX_AGE), spool_levels(SPOOL_LEVELS),
+			spool_digits(SPOOL_DIGITS), cache_retention(CACHE_RETENTION),
+			reap_rate(REAP_RATE), f_mode(FILTERING_MODE),
+			archive_mode(ARCHIVE_OFF), archive_dir(), replay_port(REPLAY_PORT) {}
 
 		long getRedirLimit() const { return redir_limit; }
 		long getConnTimeout() const { return conn_timeo; }
@@ -158,13 +307,37 @@ class InfernoConf {
 		long getLowSpeedLimit() const { return low_speed_lim; }
 		long getLowSpeedTime() const { return low_speed_time; }
 		long getAcceptanceThreshold() const { return acc_thresh; }
+		long getFailureBackoff() const { return fail_backoff; }
+		long getFailureBackoffMax() const { return fail_backoff_max; }
+		long getDnsCacheTTL() const { return dns_ttl; }
+		long getHedgePercentile() const { return hedge_pct; }
+		long getHedgeRatio() const { return hedge_ratio; }
+		long getMinImageWidth() const { return min_width; }
+		long getPartialScans() const { return partial_scans; }
+		long getPartialConfidence() const { return partial_conf; }
+		long getPrefetchLinks() const { return prefetch_links; }
+		long getPrefetchRate() const { return prefetch_rate; }
+		long getStylesheetTTL() const { return css_ttl; }
+		long getSpoolHigh() const { return spool_high; }
+		long getSpoolLow() const { return spool_low; }
+		long getSpoolMaxAge() const { return spool_max_age; }
+		long getSpoolLevels() const { return spool_levels; }
+		long getSpoolDigits() const { return spool_digits; }
+		long getCacheRetention() const { return cache_retention; }
+		long getReapRate() const { return reap_rate; }
 		FilteringMode getFilteringMode() const { return f_mode; }
+		ArchiveMode getArchiveMode() const { return archive_mode; }
+		std::string getArchiveDir() const { return archive_dir; }
+		long getReplayPort() const { return replay_port; }
 		std::string getHostname() const { return cache_host; }
 		std::string getStore() const { return cache_store; }
 		std::string getTable() const { return cache_table; }
 		std::string getUsername() const { return cache_uname; }
 		std::string getPassword() const { return cache_passwd; }
 		std::string getDirectory() const { return cache_dir; }
+		CacheBackend getCacheBackend() const { return cache_backend; }
+		std::string getLocalStore() const { return local_store; }
+		long getLocalSlots() const { return local_slots; }
 
 		void setRedirLimit(long l) { redir_limit = l; }
 		void setConnTimeout(long l) { conn_timeo = l; }
@@ -173,15 +346,40 @@ class InfernoConf {
 		void setLowSpeedLimit(long l) { low_speed_lim = l; }
 		void setLowSpeedTime(long l) { low_speed_time = l; }
 		void setAcceptanceThreshold(long l) { acc_thresh = l; }
+		void setFailureBackoff(long l) { fail_backoff = l; }
+		void setFailureBackoffMax(long l) { fail_backoff_max = l; }
+		void setDnsCacheTTL(long l) { dns_ttl = l; }
+		void setHedgePercentile(long l) { hedge_pct = l; }
+		void setHedgeRatio(long l) { hedge_ratio = l; }
+		void setMinImageWidth(long l) { min_width = l; }
+		void setPartialScans(long l) { partial_scans = l; }
+		void setPartialConfidence(long l) { partial_conf = l; }
+		void setPrefetchLinks(long l) { prefetch_links = l; }
+		void setPrefetchRate(long l) { prefetch_rate = l; }
+		void setStylesheetTTL(long l) { css_ttl = l; }
+		void setSpoolHigh(long l) { spool_high = l; }
+		void setSpoolLow(long l) { spool_low = l; }
+		void setSpoolMaxAge(long l) { spool_max_age = l; }
+		void setSpoolLevels(long l) { spool_levels = l; }
+		void setSpoolDigits(long l) { spool_digits = l; }
+		void setCacheRetention(long l) { cache_retention = l; }
+		void setReapRate(long l) { reap_rate = l; }
 		void setFilteringMode(FilteringMode l) { f_mode = l; }
+		void setArchiveMode(ArchiveMode l) { archive_mode = l; }
+		void setArchiveDir(std::string s) { archive_dir = s; }
+		void setReplayPort(long l) { replay_port = l; }
 		void setHostname(std::string s) { cache_host = s; }
 		void setStore(std::string s) { cache_store = s; }
 		void setTable(std::string s) { cache_table = s; }
 		void setUsername(std::string s) { cache_uname = s; }
 		void setPassword(std::string s) { cache_passwd = s; }
 		void setDirectory(std::string s) { cache_dir = s; }
+		void setCacheBackend(CacheBackend b) { cache_backend = b; }
+		void setLocalStore(std::string s) { local_store = s; }
+		void setLocalSlots(long l) { local_slots = l; }
 
 		std::string computePathFromHash(const std::string& hash) const;
+		std::string computeLegacyPathFromHash(const std::string& hash) const;
 		std::string toString() const;
 		static InfernoConf* parseString(const std::string&);
 		static bool isImageContentType(const std::string&);
@@ -0,0 +1,65 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_JPEGSCAN_H__
+#define __MY_JPEGSCAN_H__
+
+#include <string>
+
+#include "config.h"
+
+/**
+ * Incremental JPEG marker scanner. Fed with the data of a JPEG image as it
+ * arrives, it keeps track of the progressive scans received so far; the
+ * first scans of a progressive JPEG already make up a low resolution
+ * version of the whole image.
+ */
+class JpegScanner {
+	private:
+		enum State {J_SOI1, J_SOI2, J_SEEK, J_MARKER, J_LEN1, J_LEN2, J_SKIP, J_ENTROPY, J_ENTROPY_FF, J_DONE};
+
+		State state;
+		State after_skip;
+		int marker;
+		size_t skip;
+		size_t offset;
+		size_t ff_offset;
+		bool progressive;
+		int scans;
+		size_t scan_end;
+
+		void onMarker(int m);
+
+	public:
+		JpegScanner();
+
+		void feed(const char *buf, size_t len);
+
+		bool isProgressive() const { return progressive; }
+		int getScans() const { return scans; }
+		size_t getScanEnd() const { return scan_end; }
+		bool isDone() const { return state == J_DONE; }
+
+		static bool truncate(int src, const std::string& dst, int scans, size_t& used, size_t& total);
+};
+
+#endif
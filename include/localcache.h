@@ -0,0 +1,106 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MY_LOCALCACHE_H__
+#define __MY_LOCALCACHE_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "dbcache.h"
+#include "config.h"
+
+struct LocalStoreHeader;
+struct LocalSlot;
+
+/**
+ * Embedded verdict store for single-host setups: an open-addressing hash
+ * table in a memory-mapped file, shared by all processes (srv_inferno and
+ * sead) mapping it and guarded by a robust process-shared mutex. Entries
+ * are looked up and updated in place, without any server round trip.
+ *
+ * URLs are not kept, and content types longer than a slot holds are cut
+ * short; the table does not grow, so it must be sized (LocalStore) for
+ * the number of entries expected.
+ */
+class LocalCache : public DbCache {
+	private:
+		LocalStoreHeader *header;
+		LocalSlot *slots;
+		size_t map_size;
+		int error;
+
+		/**
+		 * Share of the slots, in percent, that live entries may take up;
+		 * further inserts fail. Stores are sized so that the configured
+		 * number of entries fits.
+		 */
+		const static int MAX_LOAD;
+
+		/**
+		 * Share of the slots, in percent, that live and deleted entries
+		 * together may take up before the table is compacted. Keeps probe
+		 * runs short; as it exceeds MAX_LOAD by a tenth of the slots, each
+		 * compaction follows that many removals at least.
+		 */
+		const static int COMPACT_LOAD;
+
+		/**
+		 * Number of slots examined per call by expireUrlEntries() and
+		 * staleUrlEntries(), bounding the time the lock is held for.
+		 */
+		const static uint64_t SCAN_SLOTS;
+
+		int lock();
+		void unlock();
+		LocalSlot* find(const unsigned char *key, bool insert);
+		void erase(LocalSlot *slot);
+		void compact();
+		LocalSlot* slotOf(const std::string& hash);
+
+	public:
+		LocalCache();
+		~LocalCache();
+
+		int reconnect(int times=1);
+
+		int getErrorCode();
+		char* getErrorString();
+
+		int updateUrlStatus(const std::string& hash, InfernoConf::Status status);
+		int updateUrlClassification(const std::string& hash, InfernoConf::Classification classification);
+		int updateUrlContentType(const std::string& hash, const std::string& ctype);
+		int updateUrlFailure(const std::string& hash, const std::string& reason);
+		int insertUrlEntry(const std::string& url, std::string& hash);
+		int removeUrlEntry(const std::string& hash);
+		int renewUrlVerdict(const std::string& hash);
+
+		int lookupUrlRecord(const std::string& hash, UrlRecord& record);
+
+		int fixCache();
+		int expireUrlEntries(long age, size_t limit, bool& more);
+		int staleUrlEntries(long age, size_t limit, std::vector<std::string>& hashes);
+
+		int connect();
+		void cleanup();
+};
+
+#endif
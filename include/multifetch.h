@@ -28,6 +28,8 @@
 
 #include "seadclient.h"
 #include "dbcache.h"
+#include "jpegscan.h"
+#include "spoolwriter.h"
 #include "infernoconf.h"
 #include "config.h"
 
@@ -40,17 +42,34 @@ class Multifetch {
 
 		InfernoConf iConf;
 
-		int consult_nimage_classifier(std::string hash, std::string type, SeadClient* sclient = NULL);
-		CURL* setupHandle(const std::string& url, const std::string& path, FILE *& fp, char* errorBuffer = NULL);
+		bool background; // crawling ahead, as opposed to serving a live request
+		bool cancelled;  // the crawl gave way to live requests
+
+		struct Transfer;
+
+		int consult_nimage_classifier(std::string hash, std::string type, SeadClient* sclient = NULL, bool partial = false);
+		CURL* setupHandle(const std::string& url, SpoolWriter *spool, char* errorBuffer = NULL, int rotate = 0, JpegScanner *scanner = NULL, std::string *buffer = NULL);
+		Transfer* startTransfer(CURLM *multi_handle, const std::string& url, const std::string& hash, bool hedge);
+		static void dropTransfer(CURLM *multi_handle, Transfer *t);
+		static void cleanupHandle(CURL *handle);
+		static size_t writeSpool(char *ptr, size_t size, size_t nmemb, void *userdata);
+		static size_t writeHeader(char *ptr, size_t size, size_t nmemb, void *userdata);
+		static void archiveResponse(CURL *handle);
+		bool classifyPartial(Transfer *t);
+		void fetchStylesheets(const std::set<std::string>& css_list, std::set<std::string>& url_list);
+		static int progressBackground(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
+		InfernoConf::Classification fetchPage(const std::string& url_pt, std::string& url_pt_hash, std::string& ctype);
 
 	public:
-		Multifetch() : iConf() {
+		Multifetch() : iConf(), background(false), cancelled(false) {
 			porn_count = benign_count = bikini_count = 0;
 		}
-		Multifetch(const InfernoConf& ic) : iConf(ic) {
+		Multifetch(const InfernoConf& ic) : iConf(ic), background(false), cancelled(false) {
 			porn_count = benign_count = bikini_count = 0;
 		}
 
+		void setBackground(bool b) { background = b; }
+
 		int fetch_multi_from_list(const std::set<std::string>&, DbCache *);
 		InfernoConf::Classification extractlinks(const std::string& url_pt, std::string& url_pt_hash, std::string& ctype);
 };
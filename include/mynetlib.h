@@ -42,7 +42,7 @@ class BaseEndpoint {
 			hostname(host), servname(service), sd(NULL), sdlen(0), addr(NULL) {}
 		BaseEndpoint() :
 			hostname(), servname(), sd(NULL), sdlen(0), addr(NULL) {}
-		~BaseEndpoint();
+		virtual ~BaseEndpoint();
 		virtual int init() = 0;
 
 		int sendDataToEndpoint(const void *data, size_t datalen);
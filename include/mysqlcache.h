@@ -0,0 +1,128 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MY_MYSQLCACHE_H__
+#define __MY_MYSQLCACHE_H__
+
+#include <ctime>
+#include <mysql.h>
+
+#include "dbcache.h"
+#include "writebehind.h"
+#include "config.h"
+
+/**
+ * Verdict store kept in MySQL (see doc/schema.sql), shared by all hosts
+ * using it. Entries being fetched or classified live in a MEMORY table
+ * named after the verdict table with a '_jobs' suffix; the (InnoDB)
+ * verdict table itself is written once per entry, when its verdict is
+ * final. Only the changes that other parties wait on are written at once;
+ * the rest go through the WriteBehind queue.
+ */
+class MysqlCache : public DbCache {
+	private:
+		/* MySQL-related data structures */
+		MYSQL *conn;
+		bool mysql_connected;
+		time_t last_used;
+
+		/**
+		 * Idle time (in seconds) after which a connection is checked before
+		 * being used again.
+		 */
+		const static time_t IDLE_CHECK;
+
+		/**
+		 * Hot-path statements, prepared once per connection on first use
+		 * and executed with bound (binary) parameters thereafter.
+		 */
+		enum Statement {
+			STMT_CLAIM,
+			STMT_RELEASE,
+			STMT_GET_VERDICT,
+			STMT_SET_STATUS,
+			STMT_FIX_DECISION,
+			STMT_FIX_CTYPE,
+			STMT_FINISH,
+			STMT_GET_RECORD,
+			STMT_COUNT
+		};
+		MYSQL_STMT *stmts[STMT_COUNT];
+
+		/** Maximum number of rows sent in a single batch statement */
+		const static size_t BATCH_ROWS;
+
+		/** Length of the content type column */
+		const static size_t MAX_CTYPE;
+		unsigned long batch_seq;
+
+		std::string jobTable() const;
+		int hasVerdict(const unsigned char *key);
+		int releaseUrlEntry(const unsigned char *key);
+		void releaseBatch(unsigned long long token, const std::vector<std::string>& hashes);
+		static bool awaited(InfernoConf::Status status);
+		static void bindChange(MYSQL_BIND *params, const WriteBehind::Change& change);
+		static std::string hashKey(const std::string& hash);
+		static std::string keyList(const std::vector<std::string>& hashes, size_t from, size_t to);
+
+		std::string statementText(Statement id);
+		MYSQL_STMT* prepare(Statement id);
+		MYSQL_STMT* execute(Statement id, MYSQL_BIND *params, unsigned int *error = NULL);
+		void closeStatements();
+		int updateField(Statement id, const std::string& hash, int value);
+		int updateText(Statement id, const std::string& hash, const std::string& value);
+
+	public:
+		MysqlCache();
+		~MysqlCache();
+
+		using DbCache::init;
+		int init(const InfernoConf&);
+
+		int reconnect(int times=1);
+
+		int getErrorCode();
+		char* getErrorString();
+
+		void setInfernoConf(const InfernoConf& conf);
+
+		int updateUrlStatus(const std::string& hash, InfernoConf::Status status);
+		int updateUrlClassification(const std::string& hash, InfernoConf::Classification classification);
+		int updateUrlContentType(const std::string& hash, const std::string& ctype);
+		int updateUrlFailure(const std::string& hash, const std::string& reason);
+		int insertUrlEntry(const std::string& url, std::string& hash);
+		int insertUrlEntries(const std::vector<std::string>& urls, std::vector<std::string>& hashes, std::vector<int>& results);
+		int removeUrlEntry(const std::string& hash);
+		int renewUrlVerdict(const std::string& hash);
+
+		int lookupUrlRecord(const std::string& hash, UrlRecord& record);
+		int lookupUrlRecords(const std::set<std::string>& hashes, std::map<std::string, UrlRecord>& records);
+		int applyChanges(const std::map<std::string, WriteBehind::Change>& changes);
+
+		int fixCache();
+		int expireUrlEntries(long age, size_t limit, bool& more);
+		int staleUrlEntries(long age, size_t limit, std::vector<std::string>& hashes);
+
+		int connect();
+		void cleanup();
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_PREFETCHER_H__
+#define __MY_PREFETCHER_H__
+
+#include <deque>
+#include <set>
+#include <string>
+
+#include <pthread.h>
+
+#include "infernoconf.h"
+#include "config.h"
+
+/**
+ * Background crawl-ahead of the pages linked from the pages being served,
+ * so that the next navigation finds its verdict in the cache. Pages are
+ * fetched and classified one at a time, at idle priority, and only while
+ * no live request is being served; a live request cancels the crawl in
+ * progress.
+ */
+class Prefetcher {
+	private:
+		/**
+		 * Maximum number of links queued, and age (in seconds) after which
+		 * a queued link is dropped.
+		 */
+		const static size_t MAX_QUEUE;
+		const static double MAX_AGE;
+
+		/**
+		 * Load average per CPU below which the host is deemed idle.
+		 */
+		const static double IDLE_LOAD;
+
+		/**
+		 * Concurrent image transfers of a background crawl.
+		 */
+		const static long CONCURRENCY;
+
+		class Job {
+			public:
+				std::string url;
+				double queued;
+		};
+
+		static std::deque<Job> queue;
+		static std::set<std::string> queued;
+		static InfernoConf conf;
+		static long live;
+		static long budget_used;
+		static double budget_start;
+		static bool started;
+		static pthread_mutex_t lock;
+		static pthread_cond_t wakeup;
+
+		static bool idle();
+		static void* run(void *arg);
+
+	public:
+		static void enqueue(const std::set<std::string>& links, const InfernoConf& iConf);
+		static void liveBegin();
+		static void liveEnd();
+		static bool preempted();
+};
+
+#endif
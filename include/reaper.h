@@ -0,0 +1,83 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_REAPER_H__
+#define __MY_REAPER_H__
+
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <pthread.h>
+
+#include "infernoconf.h"
+#include "config.h"
+
+/**
+ * Process-wide remover of what the cache no longer needs: verdicts older
+ * than the retention period, entries left in progress whose spool file is
+ * gone, spool files without an entry, and temporary spool files left
+ * behind by writers that died. One process of the host (the holder of a
+ * lock on the .reaper file) goes through them in rounds, at the configured
+ * rate at most, so that the verdict table and its indexes stay small
+ * without the reaper competing with the requests being served.
+ * Spool directories are read as they are swept, a batch at a time, and
+ * each round carries on where the previous one stopped. The reaper is
+ * only run by srv_inferno, the long-lived user of the cache.
+ */
+class Reaper {
+	private:
+		/**
+		 * Seconds between rounds, and number of entries or spool files
+		 * handled per statement.
+		 */
+		const static long ROUND_INTERVAL;
+		const static size_t BATCH;
+
+		/**
+		 * Seconds an entry in progress, or a spool file, is left alone for
+		 * after last being changed.
+		 */
+		const static long GRACE;
+
+		static InfernoConf conf;
+		static int started;
+		static pthread_mutex_t lock;
+		static std::vector<DIR*> sweep_dirs;
+		static std::vector<std::string> sweep_paths;
+
+		static void* run(void *arg);
+		static void pace(const InfernoConf& iConf, size_t handled);
+		static int expire(const InfernoConf& iConf);
+		static int releaseStale(const InfernoConf& iConf);
+		static int sweep(const InfernoConf& iConf, size_t budget);
+
+	public:
+		/**
+		 * Starts the reaper thread of the calling process, unless it runs
+		 * already or reaping is disabled; a no-op (without locking) after
+		 * the first call. Returns 0 on success, 1 on failure.
+		 */
+		static int init(const InfernoConf& iConf);
+};
+
+#endif
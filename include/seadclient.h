@@ -45,6 +45,6 @@ class SeadClient {
 		SeadClient::SCResult init();
 		
 		// network classifier request/response methods
-		int classifyUri(const std::string& path, const std::string& type, const InfernoConf& iConf);
+		int classifyUri(const std::string& path, const std::string& type, const InfernoConf& iConf, bool partial = false);
 };
 #endif
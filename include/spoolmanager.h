@@ -0,0 +1,90 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MY_SPOOLMANAGER_H__
+#define __MY_SPOOLMANAGER_H__
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "infernoconf.h"
+#include "config.h"
+
+/**
+ * Process-wide keeper of the spool directory. Its root is set up once per
+ * process, and the fan-out directories below it on demand. If spool
+ * limits are configured, one process of the host (the holder of a lock on
+ * the .evictor file) keeps track of the bytes spooled, and evicts the
+ * least recently used spool files down to the low watermark once the
+ * spool grows past the high one, as well as those unused for longer than
+ * the maximum age. Only payloads are
+ * evicted; the verdicts on them are kept, and the files of entries in
+ * progress are left alone.
+ */
+class SpoolManager {
+	private:
+		/**
+		 * Seconds between checks of the spool size, and between full scans
+		 * of the spool while within its limits.
+		 */
+		const static long CHECK_INTERVAL;
+		const static long SCAN_INTERVAL;
+
+		/**
+		 * Seconds a spool file is kept for after last being used, however
+		 * full the spool, and number of files evicted per scan at most.
+		 */
+		const static long MIN_IDLE;
+		const static size_t EVICT_BATCH;
+
+		class File {
+			public:
+				std::string path;
+				std::string hash;
+				off_t size;
+				time_t used;
+
+				bool operator<(const File& f) const { return used < f.used; }
+		};
+
+		static std::set<std::string> ready;
+		static InfernoConf conf;
+		static bool started;
+		static pthread_mutex_t lock;
+
+		static void* run(void *arg);
+		static off_t scan(const InfernoConf& iConf, std::vector<File>& oldest, std::vector<File>& expired);
+		static void walk(const std::string& dir, int depth, time_t now, const InfernoConf& iConf,
+				off_t& total, std::vector<File>& oldest, std::vector<File>& expired);
+		static off_t evict(const InfernoConf& iConf, std::vector<File>& files, off_t excess);
+		static unsigned long long usedBytes(const std::string& dir);
+
+	public:
+		static int checkAndCreateDir(const char *path);
+		static int init(const InfernoConf& iConf);
+		static int makeParents(const std::string& path);
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MY_SPOOLWRITER_H__
+#define __MY_SPOOLWRITER_H__
+
+#include <string>
+
+#include <sys/types.h>
+
+#include "config.h"
+
+/**
+ * Writes a spool file in large aligned chunks to an anonymous (O_TMPFILE)
+ * or temporary file, and only makes it visible at its final path once
+ * complete, so that readers never see a partially written file.
+ */
+class SpoolWriter {
+	private:
+		const static size_t BUFSIZE;
+		const static size_t ALIGNMENT;
+
+		std::string path;
+		std::string tmp_path; // empty for anonymous files
+		int fd;
+		char *buf;
+		size_t buffered;
+		off_t written;
+		bool published;
+
+		int writeOut(const char *data, size_t len);
+		int link();
+
+	public:
+		SpoolWriter(const std::string& path);
+		~SpoolWriter();
+
+		int open();
+		size_t write(const char *data, size_t len);
+		void preallocate(off_t len);
+		int flush();
+		int publish();
+		void discard();
+
+		int getFd() const { return fd; }
+		off_t size() const { return written + buffered; }
+		const std::string& getPath() const { return path; }
+		void setPath(const std::string& p) { path = p; }
+};
+
+#endif
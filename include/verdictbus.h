@@ -0,0 +1,62 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MY_VERDICTBUS_H__
+#define __MY_VERDICTBUS_H__
+
+#include <string>
+
+#include <pthread.h>
+
+#include "infernoconf.h"
+#include "config.h"
+
+/**
+ * Host-wide notification of final verdicts, so that the parties waiting
+ * for an entry another process works on need not poll the cache for it.
+ * The bus is a table of futex words, shared through a file in the spool
+ * directory: each word counts the verdicts published on the entries it
+ * stands for. Since verdicts made on other hosts are not published here,
+ * waits time out after a few poll intervals, and the cache is looked up
+ * anyway.
+ */
+class VerdictBus {
+	private:
+		/**
+		 * Number of words (entries sharing a word wake up each other's
+		 * waiters), and number of poll intervals a wait lasts at most.
+		 */
+		const static size_t WORDS;
+		const static long FALLBACK_POLLS;
+
+		static volatile unsigned int *table;
+		static bool attached;
+		static pthread_mutex_t lock;
+
+		static volatile unsigned int* word(const InfernoConf& conf, const std::string& hash);
+
+	public:
+		static unsigned int sequence(const InfernoConf& conf, const std::string& hash);
+		static void publish(const InfernoConf& conf, const std::string& hash);
+		static void wait(const InfernoConf& conf, unsigned int seen, const std::string& hash);
+};
+
+#endif
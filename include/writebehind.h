@@ -0,0 +1,78 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MY_WRITEBEHIND_H__
+#define __MY_WRITEBEHIND_H__
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <pthread.h>
+
+#include "infernoconf.h"
+#include "config.h"
+
+/**
+ * Process-wide write-behind queue of the changes to entries in progress
+ * that nobody waits on (intermediate states, content type, decision).
+ * The changes to an entry are merged, and either folded into the next
+ * change to it that is written synchronously, or flushed in batches by a
+ * background thread once they have been queued for a while.
+ */
+class WriteBehind {
+	public:
+		class Change {
+			public:
+				int status;
+				int decision;
+				bool has_ctype;
+				std::string ctype;
+				double queued;
+
+				Change() : status(-1), decision(-1), has_ctype(false), queued(0) {}
+				bool empty() const { return status < 0 && decision < 0 && !has_ctype; }
+		};
+
+	private:
+		/**
+		 * Time (in seconds) a change is kept back for, and number of
+		 * queued entries that triggers a flush regardless.
+		 */
+		const static double FLUSH_DELAY;
+		const static size_t MAX_QUEUE;
+
+		static std::map<std::string, Change> queue;
+		static std::set<std::string> flushing;
+		static InfernoConf conf;
+		static bool started;
+		static pthread_mutex_t lock;
+		static pthread_cond_t wakeup;
+		static pthread_cond_t flushed;
+
+		static void* run(void *arg);
+
+	public:
+		static void defer(const InfernoConf& iConf, const std::string& hash, const Change& change);
+		static Change take(const std::string& hash);
+};
+
+#endif
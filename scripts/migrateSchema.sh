@@ -0,0 +1,154 @@
+#!/bin/sh
+#
+# Converts a verdict cache table of an earlier layout (MyISAM, ENUM status
+# and decision, char(32) or binary(16) hash, unique URL index) to the one
+# of doc/schema.sql, while InFeRno keeps using it, and creates the table of
+# the entries in progress (<table>_jobs), the failure details (failures,
+# reason, retry_after) and the index on the modification time if missing.
+#
+# The new table is filled in chunks of <chunk> rows, and triggers on the old
+# one mirror the changes made meanwhile. Once the copy is complete, the
+# tables are swapped with an atomic RENAME; the old one is kept as
+# <table>_old. Only verdicts (done or failed entries) are copied; entries
+# in progress are fetched anew when next requested. The MySQL user needs
+# the TRIGGER privilege on the table.
+#
+# Usage: migrateSchema.sh [-c <chunk>] [-s <secs>] <database> <table> [<mysql options>...]
+
+CHUNK=10000
+PAUSE=0
+
+while getopts "c:s:" opt; do
+	case $opt in
+		c) CHUNK=$OPTARG ;;
+		s) PAUSE=$OPTARG ;;
+		*) exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+[ $# -lt 2 ] && echo "Usage: $0 [-c <chunk>] [-s <secs>] <database> <table> [<mysql options>...]" && exit 1
+
+DB=$1
+TABLE=$2
+shift 2
+NEW=${TABLE}_new
+OLD=${TABLE}_old
+
+sql() {
+	mysql -N -B "$@" "$DB"
+}
+
+column_type() {
+	echo "SELECT DATA_TYPE FROM information_schema.COLUMNS WHERE TABLE_SCHEMA='$DB' AND TABLE_NAME='$TABLE' AND COLUMN_NAME='$1'" | sql $MYSQL_OPTS
+}
+
+# prints the number of indexes whose first column is the given one
+column_indexes() {
+	echo "SELECT COUNT(*) FROM information_schema.STATISTICS WHERE TABLE_SCHEMA='$DB' AND TABLE_NAME='$TABLE' AND COLUMN_NAME='$1' AND SEQ_IN_INDEX=1" | sql $MYSQL_OPTS
+}
+
+MYSQL_OPTS="$*"
+
+# prints the CREATE TABLE statement of doc/schema.sql for the given table,
+# named after the second argument
+schema() {
+	sed -n "/^CREATE TABLE $1\$/,/;/p" $(dirname $0)/../doc/schema.sql | sed "s/^CREATE TABLE $1/CREATE TABLE $2/"
+}
+
+echo "Creating ${TABLE}_jobs..."
+schema cache_jobs "IF NOT EXISTS ${TABLE}_jobs" | sql $MYSQL_OPTS || exit 1
+
+if [ "$(column_type id)" = "" ]; then
+	# entries in progress are kept in ${TABLE}_jobs now
+	if [ "$(column_type ins_token)" != "" ]; then
+		echo "Dropping $TABLE.ins_token..."
+		echo "ALTER TABLE $TABLE DROP COLUMN ins_token" | sql $MYSQL_OPTS || exit 1
+	fi
+	# failed entries are backed off according to these (inferno.FailureBackoff)
+	if [ "$(column_type failures)" = "" ]; then
+		echo "Adding $TABLE.failures..."
+		echo "ALTER TABLE $TABLE ADD COLUMN failures int unsigned not null default 0 AFTER status" | sql $MYSQL_OPTS || exit 1
+	fi
+	if [ "$(column_type reason)" = "" ]; then
+		echo "Adding $TABLE.reason..."
+		echo "ALTER TABLE $TABLE ADD COLUMN reason varchar(255) not null default '' AFTER failures" | sql $MYSQL_OPTS || exit 1
+	fi
+	if [ "$(column_type retry_after)" = "" ]; then
+		echo "Adding $TABLE.retry_after..."
+		echo "ALTER TABLE $TABLE ADD COLUMN retry_after datetime null default null AFTER reason" | sql $MYSQL_OPTS || exit 1
+	fi
+	# expired verdicts are looked up by modification time
+	if [ "$(column_indexes modified)" = "0" ]; then
+		echo "Indexing $TABLE.modified..."
+		echo "ALTER TABLE $TABLE ADD INDEX (modified)" | sql $MYSQL_OPTS || exit 1
+	fi
+	echo "$TABLE has no id column; nothing else to migrate."
+	exit 0
+fi
+
+# expressions converting the columns of a row of the old table ($1 is NEW,
+# OLD or the table name) to those of the new one
+case "$(column_type hash)" in
+	char|varchar) HASH="UNHEX(\$R.hash)" ;;
+	*) HASH="\$R.hash" ;;
+esac
+MODIFIED="NOW()"
+[ "$(column_type modified)" != "" ] && MODIFIED="\$R.modified"
+# the original layout keeps no failure details
+FAILURES="0"
+[ "$(column_type failures)" != "" ] && FAILURES="\$R.failures"
+REASON="''"
+[ "$(column_type reason)" != "" ] && REASON="\$R.reason"
+RETRY_AFTER="NULL"
+[ "$(column_type retry_after)" != "" ] && RETRY_AFTER="\$R.retry_after"
+
+COLUMNS="hash, url, decision, ctype, status, failures, reason, retry_after, modified"
+VALUES="$HASH, \$R.url, \$R.decision+0, LEFT(\$R.ctype, 255), \$R.status+0, $FAILURES, $REASON, $RETRY_AFTER, $MODIFIED"
+
+# only verdicts are copied; entries in progress belong in ${TABLE}_jobs, and
+# are fetched anew when next requested (status+0 is the status number for
+# both ENUM and integer columns)
+FINAL="IN (5, 6)"
+
+row() {
+	echo "$VALUES" | sed "s/\\\$R/$1/g"
+}
+
+set -e
+
+echo "Creating $NEW..."
+schema cache $NEW | sql $MYSQL_OPTS
+
+echo "Installing triggers on $TABLE..."
+sql $MYSQL_OPTS << _EOF
+CREATE TRIGGER ${TABLE}_mig_ins AFTER INSERT ON $TABLE FOR EACH ROW
+	REPLACE INTO $NEW ($COLUMNS) SELECT $(row NEW) FROM DUAL WHERE NEW.status+0 $FINAL;
+CREATE TRIGGER ${TABLE}_mig_upd AFTER UPDATE ON $TABLE FOR EACH ROW
+	REPLACE INTO $NEW ($COLUMNS) SELECT $(row NEW) FROM DUAL WHERE NEW.status+0 $FINAL;
+CREATE TRIGGER ${TABLE}_mig_del AFTER DELETE ON $TABLE FOR EACH ROW
+	DELETE FROM $NEW WHERE hash = $(echo "$HASH" | sed 's/\$R/OLD/');
+_EOF
+
+# rows copied already, or changed since by the triggers, are left alone
+MAX=$(echo "SELECT IFNULL(MAX(id), 0) FROM $TABLE" | sql $MYSQL_OPTS)
+FROM=0
+while [ $FROM -lt $MAX ]; do
+	TO=$((FROM + CHUNK))
+	echo "INSERT IGNORE INTO $NEW ($COLUMNS) SELECT $(row $TABLE) FROM $TABLE WHERE id > $FROM AND id <= $TO AND status+0 $FINAL" | sql $MYSQL_OPTS
+	echo "Copied rows up to id $TO of $MAX"
+	FROM=$TO
+	if [ $PAUSE -gt 0 ]; then
+		sleep $PAUSE
+	fi
+done
+
+echo "Swapping tables..."
+sql $MYSQL_OPTS << _EOF
+RENAME TABLE $TABLE TO $OLD, $NEW TO $TABLE;
+DROP TRIGGER ${TABLE}_mig_ins;
+DROP TRIGGER ${TABLE}_mig_upd;
+DROP TRIGGER ${TABLE}_mig_del;
+_EOF
+
+echo "Done. The old table is kept as $OLD; drop it once satisfied."
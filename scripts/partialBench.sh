@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Assesses early classification of progressive JPEGs: extracts features of
+# the given images both in full and from their first <scans> scans, and
+# reports the bytes needed and the accuracy of <model> in either case.
+#
+# Usage: partialBench.sh <scans> <model> <label> <image>...
+
+[ $# -lt 4 ] && echo "Usage: $0 <scans> <model> <label> <image>..." && exit 1
+
+SCANS=$1
+MODEL=$2
+LABEL=$3
+shift 3
+
+BINDIR=$(dirname $0)/../src/bin
+TMP=$(mktemp -d)
+trap "rm -rf $TMP" EXIT
+
+for img in "$@"; do
+	# skip images that are not progressive or have too few scans
+	$BINDIR/imclassifier -q $LABEL -c "$img" -p $SCANS -l $TMP/partial.csv 2>>$TMP/bytes || continue
+	$BINDIR/imclassifier -q $LABEL -c "$img" -l $TMP/full.csv
+done
+
+awk '/ bytes$/ { n++; used += $2; total += $4 } END { printf "Images: %d, bytes used: %d of %d (%.1f%% saved)\n", n, used, total, total ? 100 * (total - used) / total : 0 }' $TMP/bytes
+
+for f in full partial; do
+	$(dirname $0)/raw2model.sh < $TMP/$f.csv > $TMP/$f.svm
+	echo -n "$f: "
+	svm-predict -b 1 $TMP/$f.svm $MODEL $TMP/$f.out | grep Accuracy
+done
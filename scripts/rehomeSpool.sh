@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Moves the files of a spool directory to the layout of the given fan-out
+# (see inferno.SpoolFanout), wherever they are below it, and removes the
+# directories left empty. Files are hard-linked to their new path before
+# being unlinked from the old one, so InFeRno may keep running meanwhile;
+# files present at both paths are left at the new one. Empty directories
+# changed in the last 10 minutes are kept, as InFeRno may have just
+# created them for a file to come; those emptied by the move itself are
+# removed by running the script again later.
+#
+# Usage: rehomeSpool.sh <spool dir> <levels> <digits>
+
+[ $# -lt 3 ] && echo "Usage: $0 <spool dir> <levels> <digits>" && exit 1
+
+SPOOL=${1%/}
+LEVELS=$2
+DIGITS=$3
+
+if [ "$LEVELS" -lt 1 -o "$LEVELS" -gt 4 -o "$DIGITS" -lt 1 -o "$DIGITS" -gt 3 ]; then
+	echo "Levels must be within 1-4 and digits within 1-3"
+	exit 1
+fi
+
+# prints the path of the given hash under the new fan-out
+target() {
+	DIR=$SPOOL
+	I=0
+	while [ $I -lt $LEVELS ]; do
+		DIR=$DIR/$(echo "$1" | cut -c$((I * DIGITS + 1))-$(((I + 1) * DIGITS)))
+		I=$((I + 1))
+	done
+	echo "$DIR/$1"
+}
+
+MOVED=0
+find "$SPOOL" -mindepth 1 -maxdepth 5 -type f | grep -E '/[0-9a-f]{32}$' | while read FILE; do
+	NEW=$(target "$(basename "$FILE")")
+	[ "$FILE" = "$NEW" ] && continue
+
+	mkdir -p -m 0700 "$(dirname "$NEW")" || exit 1
+	if [ -e "$NEW" ] || ln "$FILE" "$NEW"; then
+		rm -f "$FILE"
+	fi
+	MOVED=$((MOVED + 1))
+	[ $((MOVED % 10000)) -eq 0 ] && echo "Moved $MOVED files"
+done
+
+find "$SPOOL" -mindepth 1 -depth -type d -empty -mmin +10 -delete
+echo "Done."
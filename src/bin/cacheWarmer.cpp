@@ -0,0 +1,435 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+#include <mysql.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dbcache.h"
+#include "fetchstats.h"
+#include "multifetch.h"
+#include "logger.h"
+#include "infernoconf.h"
+#include "config.h"
+
+#define MAX_LINE 10 * 1024
+
+using namespace std;
+
+/**
+ * Interval (in seconds) after which a URL found in the cache is checked
+ * again, and maximum number of URLs ranked.
+ */
+static const double RECHECK_INTERVAL = 3600.0;
+static const size_t MAX_URLS = 100000;
+
+/**
+ * Share of the retention period (inferno.CacheRetention) after which a
+ * cached verdict of a popular URL is renewed, before the reaper expires it.
+ */
+static const double REWARM_SHARE = 0.9;
+
+// popularity of a URL, decaying exponentially with the age of its requests
+struct UrlRank {
+	double score;
+	double seen;   // time of the latest request
+	double warmed; // last time found in or put into the cache, 0 if never
+	bool queued;
+};
+
+static map<string, UrlRank> ranks;
+static deque<string> jobs;
+static long pending = 0;    // URLs handed to the workers and not done yet
+static bool input_done = false;
+static double half_life = 3600.0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+void *read_log(void *arg);
+void *warm(void *arg);
+
+static double decayed(const UrlRank& r, double now) {
+	return r.score * pow(0.5, (now - r.seen) / half_life);
+}
+
+/**
+ * Accounts for a request of the given URL at the given time. Requests
+ * older than the latest one (as when reading a log from its start) count
+ * for less.
+ */
+static void touch(const string& url, double when) {
+	map<string, UrlRank>::iterator it = ranks.find(url);
+
+	if (it == ranks.end()) {
+		UrlRank r;
+		r.score = 1;
+		r.seen = when;
+		r.warmed = 0;
+		r.queued = false;
+		ranks[url] = r;
+	} else if (when >= it->second.seen) {
+		it->second.score = decayed(it->second, when) + 1;
+		it->second.seen = when;
+	} else
+		it->second.score += pow(0.5, (it->second.seen - when) / half_life);
+}
+
+/**
+ * Extracts the requested URL (and time of the request, if known) out of a
+ * line of a Squid access.log in native format, or of a line holding just
+ * a URL. Returns false for lines of no interest.
+ */
+static bool parse_line(char *line, string& url, double& when) {
+	char *tok[7];
+	char *saveptr = NULL;
+	int n;
+
+	for (n = 0; n < 7 && (tok[n] = strtok_r(n ? NULL : line, " \t\r\n", &saveptr)); n++)
+		;
+
+	if (n == 1) {
+		url = tok[0];
+		when = FetchStats::now();
+	} else if (n == 7) {
+		// time elapsed client code/status bytes method URL ...
+		if (strcmp(tok[5], "GET"))
+			return false;
+		// don't bother with what the origin refused to serve
+		char *status = strchr(tok[3], '/');
+		if (status && (status[1] == '4' || status[1] == '5'))
+			return false;
+		url = tok[6];
+		when = atof(tok[0]);
+	} else
+		return false;
+
+	return !strncasecmp(url.c_str(), "http://", 7) || !strncasecmp(url.c_str(), "https://", 8);
+}
+
+/**
+ * Drops the least popular URLs once too many are being ranked.
+ */
+static void prune(double now) {
+	vector<pair<double, string> > scores;
+
+	if (ranks.size() <= MAX_URLS)
+		return;
+
+	for (map<string, UrlRank>::iterator it = ranks.begin(); it != ranks.end(); it++) {
+		if (!it->second.queued)
+			scores.push_back(make_pair(decayed(it->second, now), it->first));
+	}
+	sort(scores.begin(), scores.end());
+
+	size_t drop = ranks.size() - MAX_URLS * 9 / 10;
+	for (size_t i = 0; i < drop && i < scores.size(); i++)
+		ranks.erase(scores[i].second);
+}
+
+int main(int argc, char **argv) {
+	const char *log_path = NULL;
+	long workers = 2;
+	long rate = 30;           // pages per minute
+	long bandwidth = 0;       // KB/s, 0 for no limit
+	double max_load = 0.75;   // per CPU
+	double min_score = 2.0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	pthread_t tid;
+	InfernoConf iConf;
+	DbCache *cache;
+
+	while ((opt = getopt(argc, argv, "f:j:r:b:l:m:H:R:")) != -1) {
+		switch (opt) {
+			case 'f':
+				log_path = optarg;
+				break;
+			case 'j':
+				workers = atol(optarg);
+				break;
+			case 'r':
+				rate = atol(optarg);
+				break;
+			case 'b':
+				bandwidth = atol(optarg);
+				break;
+			case 'l':
+				max_load = atof(optarg);
+				break;
+			case 'm':
+				min_score = atof(optarg);
+				break;
+			case 'H':
+				half_life = atof(optarg);
+				break;
+			case 'R':
+				iConf.setCacheRetention(atol(optarg));
+				break;
+			default:
+				workers = 0;
+				break;
+		}
+	}
+
+	if (optind != argc || workers <= 0 || rate <= 0 || half_life <= 0 || iConf.getCacheRetention() < 0) {
+		fprintf(stderr, "Usage: %s [-f <access_log>] [-j <workers>] [-r <pages/min>] [-b <KB/s>] [-l <load/cpu>] [-m <min_hits>] [-H <half_life>] [-R <retention>]\n", argv[0]);
+		fprintf(stderr, "Reads URLs or Squid log lines from stdin, unless an access log to follow is given.\n");
+		fprintf(stderr, "Verdicts near the end of the retention period (inferno.CacheRetention, in seconds) are renewed.\n");
+		return 1;
+	}
+
+	// check cached URLs often enough to renew them before they expire
+	double recheck = RECHECK_INTERVAL;
+	if (iConf.getCacheRetention() && iConf.getCacheRetention() * (1 - REWARM_SHARE) < recheck)
+		recheck = iConf.getCacheRetention() * (1 - REWARM_SHARE);
+
+	// stay out of the way of the proxy and the classifier
+	if (setpriority(PRIO_PROCESS, 0, 19))
+		Logger::warn("Unable to lower the priority of the warmer");
+
+	Logger::debug("Initializing libmysqlclient");
+	if (mysql_library_init(0, NULL, NULL))
+		Logger::bail("Unable to initialize MySQL library");
+	cache = DbCache::create(iConf);
+	if (cache->init(iConf) || !cache->connect())
+		Logger::bail("Could not connect to caching server");
+
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+	if (pthread_create(&tid, NULL, read_log, (void *)log_path))
+		Logger::bail("Unable to start the log reader");
+	pthread_detach(tid);
+
+	for (long i = 0; i < workers; i++) {
+		if (pthread_create(&tid, NULL, warm, (void *)&iConf))
+			Logger::bail("Unable to start the warmer threads");
+		pthread_detach(tid);
+	}
+
+	double window_start = FetchStats::now();
+	double window_bytes = FetchStats::getBytes();
+	double last_report = window_start;
+	long dispatched = 0;  // pages in the current minute
+	long warmed = 0, cached = 0;
+
+	while (true) {
+		double now = FetchStats::now();
+		vector<pair<double, string> > candidates;
+
+		if (now - window_start >= 60.0) {
+			window_start = now;
+			window_bytes = FetchStats::getBytes();
+			dispatched = 0;
+		}
+
+		pthread_mutex_lock(&lock);
+		prune(now);
+
+		for (map<string, UrlRank>::iterator it = ranks.begin(); it != ranks.end(); it++) {
+			UrlRank& r = it->second;
+			if (r.queued || (r.warmed && now - r.warmed < recheck))
+				continue;
+			double score = decayed(r, now);
+			if (score >= min_score || (input_done && !log_path))
+				candidates.push_back(make_pair(-score, it->first));
+		}
+
+		if (input_done && candidates.empty() && !pending && jobs.empty()) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		long idle = workers - pending - (long)jobs.size();
+		pthread_mutex_unlock(&lock);
+
+		// most popular first
+		sort(candidates.begin(), candidates.end());
+
+		for (size_t i = 0; i < candidates.size() && idle > 0; i++) {
+			double load;
+
+			// budgets: pages per minute, bandwidth and CPU load
+			if (dispatched >= rate)
+				break;
+			if (bandwidth && FetchStats::getBytes() - window_bytes > bandwidth * 1024.0 * (now - window_start + 1))
+				break;
+			if (getloadavg(&load, 1) == 1 && load > max_load * ((cpus > 0) ? cpus : 1))
+				break;
+
+			const string& url = candidates[i].second;
+			string *hash = cache->makeHashByurl(url);
+			UrlRecord record;
+			bool done = hash && cache->lookupUrlRecord(*hash, record) > 0 && record.status == InfernoConf::STATUS_DONE;
+
+			// renew verdicts about to expire in place, so that popular URLs
+			// never miss in between
+			if (done && iConf.getCacheRetention() && now - record.modified >= iConf.getCacheRetention() * REWARM_SHARE &&
+					cache->renewUrlVerdict(*hash) <= 0)
+				Logger::debug("Failed to renew the verdict on %s", url.c_str());
+			delete hash;
+
+			pthread_mutex_lock(&lock);
+			map<string, UrlRank>::iterator it = ranks.find(url);
+			if (it != ranks.end()) {
+				if (done) {
+					// already classified; nothing to spend the budget on
+					it->second.warmed = now;
+					cached++;
+				} else {
+					it->second.queued = true;
+					jobs.push_back(url);
+					pthread_cond_signal(&wakeup);
+					dispatched++;
+					warmed++;
+					idle--;
+				}
+			}
+			pthread_mutex_unlock(&lock);
+		}
+
+		if (now - last_report >= 60.0) {
+			last_report = now;
+			pthread_mutex_lock(&lock);
+			Logger::info("Ranking %ld URLs, %ld warmed, %ld found cached, %.0lf bytes fetched", (long)ranks.size(), warmed, cached, FetchStats::getBytes());
+			pthread_mutex_unlock(&lock);
+		}
+
+		sleep(1);
+	}
+
+	Logger::info("Done: %ld URLs warmed, %ld found cached", warmed, cached);
+	return 0;
+}
+
+/**
+ * Reads URLs from stdin, or follows the given access log across rotations.
+ */
+void *read_log(void *arg) {
+	const char *path = (const char *)arg;
+	FILE *fp = path ? NULL : stdin;
+	ino_t ino = 0;
+	string carry;
+	char *buff = new char[MAX_LINE];
+
+	while (true) {
+		struct stat st;
+
+		if (!fp) {
+			if (!(fp = fopen(path, "r")) || fstat(fileno(fp), &st)) {
+				if (fp)
+					fclose(fp);
+				fp = NULL;
+				sleep(1);
+				continue;
+			}
+			ino = st.st_ino;
+		}
+
+		if (fgets(buff, MAX_LINE, fp)) {
+			// a line still being written is completed on the next read
+			size_t len = strlen(buff);
+			if (len && buff[len - 1] != '\n' && path) {
+				carry.append(buff, len);
+				continue;
+			}
+			carry.append(buff, len);
+
+			string url;
+			double when;
+			vector<char> line(carry.begin(), carry.end());
+			line.push_back('\0');
+			carry.clear();
+			if (parse_line(&line[0], url, when)) {
+				pthread_mutex_lock(&lock);
+				touch(url, when);
+				pthread_mutex_unlock(&lock);
+			}
+			continue;
+		}
+
+		if (!path)
+			break;
+
+		// reopen the log once rotated or truncated
+		clearerr(fp);
+		if (stat(path, &st) || st.st_ino != ino || st.st_size < ftell(fp)) {
+			fclose(fp);
+			fp = NULL;
+			carry.clear();
+			continue;
+		}
+		sleep(1);
+	}
+
+	pthread_mutex_lock(&lock);
+	input_done = true;
+	pthread_mutex_unlock(&lock);
+	delete[] buff;
+	return NULL;
+}
+
+/**
+ * Classifies the URLs handed out by the scheduler, one at a time, with the
+ * configuration passed as argument.
+ */
+void *warm(void *arg) {
+	InfernoConf *iConf = (InfernoConf *)arg;
+
+	while (true) {
+		string url, hash, ctype;
+
+		pthread_mutex_lock(&lock);
+		while (jobs.empty())
+			pthread_cond_wait(&wakeup, &lock);
+		url = jobs.front();
+		jobs.pop_front();
+		pending++;
+		pthread_mutex_unlock(&lock);
+
+		Multifetch multifetch(*iConf);
+		if (multifetch.extractlinks(url, hash, ctype) == InfernoConf::CLASS_ERROR)
+			Logger::debug("Failed to warm %s", url.c_str());
+
+		pthread_mutex_lock(&lock);
+		map<string, UrlRank>::iterator it = ranks.find(url);
+		if (it != ranks.end()) {
+			it->second.queued = false;
+			it->second.warmed = FetchStats::now();
+		}
+		pending--;
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
@@ -0,0 +1,210 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <mysql.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "dbcache.h"
+#include "logger.h"
+#include "infernoconf.h"
+#include "config.h"
+
+using namespace std;
+
+/**
+ * Measures the throughput of the verdict store for the traffic a
+ * classification causes: an insert, the status and verdict updates of the
+ * object's life cycle and the lookups of waiters, followed by a delete.
+ * To compare two table layouts, run it with the same options against a
+ * table of each (for instance, against <table>_old and <table> after
+ * scripts/migrateSchema.sh), on the same server.
+ */
+
+enum Phase { PHASE_INSERT, PHASE_UPDATE, PHASE_LOOKUP, PHASE_DELETE, PHASES };
+
+static const char *phase_names[PHASES] = { "insert", "update", "lookup", "delete" };
+
+struct BenchThread {
+	pthread_t tid;
+	int id;
+	long count;
+	InfernoConf *iConf;
+	double elapsed[PHASES];
+	long ops[PHASES];
+	long errors;
+};
+
+static pthread_barrier_t barrier;
+
+static double now() {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void *bench(void *arg) {
+	BenchThread *t = (BenchThread *)arg;
+	vector<string> hashes(t->count);
+	DbCache *cache;
+	UrlRecord record;
+	double start;
+
+	mysql_thread_init();
+	cache = DbCache::create(*t->iConf);
+	if (cache->init(*t->iConf) || !cache->connect()) {
+		Logger::error("Could not connect to caching server. Error report: %s", cache->getErrorString());
+		t->errors = t->count;
+	}
+
+	for (int p = 0; p < PHASES; p++) {
+		pthread_barrier_wait(&barrier);
+		start = now();
+		for (long i = 0; i < t->count && !t->errors; i++) {
+			char url[128];
+
+			switch (p) {
+				case PHASE_INSERT:
+					snprintf(url, sizeof(url), "http://dbbench.invalid/%d/%d/%ld.jpg", getpid(), t->id, i);
+					if (cache->insertUrlEntry(url, hashes[i]) != 1)
+						t->errors++;
+					t->ops[p]++;
+					break;
+				case PHASE_UPDATE:
+					cache->updateUrlStatus(hashes[i], InfernoConf::STATUS_PROCESSING);
+					cache->updateUrlStatus(hashes[i], InfernoConf::STATUS_CLASSIFYING);
+					cache->updateUrlContentType(hashes[i], "image/jpeg");
+					cache->updateUrlClassification(hashes[i], InfernoConf::CLASS_BENIGN);
+					if (!cache->updateUrlStatus(hashes[i], InfernoConf::STATUS_DONE))
+						t->errors++;
+					t->ops[p] += 5;
+					break;
+				case PHASE_LOOKUP:
+					if (!cache->lookupUrlRecord(hashes[i], record) || record.status != InfernoConf::STATUS_DONE)
+						t->errors++;
+					t->ops[p]++;
+					break;
+				case PHASE_DELETE:
+					// with back-off disabled, a failure removes the entry
+					cache->updateUrlFailure(hashes[i], "dbbench");
+					t->ops[p]++;
+					break;
+			}
+		}
+		t->elapsed[p] = now() - start;
+	}
+
+	delete cache;
+	mysql_thread_end();
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	long count = 10000;
+	long threads = 4;
+	InfernoConf iConf;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:j:H:D:T:U:P:L:")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atol(optarg);
+				break;
+			case 'j':
+				threads = atol(optarg);
+				break;
+			case 'H':
+				iConf.setHostname(optarg);
+				break;
+			case 'D':
+				iConf.setStore(optarg);
+				break;
+			case 'T':
+				iConf.setTable(optarg);
+				break;
+			case 'U':
+				iConf.setUsername(optarg);
+				break;
+			case 'P':
+				iConf.setPassword(optarg);
+				break;
+			case 'L':
+				iConf.setCacheBackend(InfernoConf::BACKEND_LOCAL);
+				iConf.setLocalStore(optarg);
+				break;
+			default:
+				count = 0;
+				break;
+		}
+	}
+
+	if (optind != argc || count <= 0 || threads <= 0) {
+		fprintf(stderr, "Usage: %s [-n <objects/thread>] [-j <threads>] [-H <db host>] [-D <db name>] [-T <table>] [-U <user>] [-P <password>] [-L <local store>]\n", argv[0]);
+		return 1;
+	}
+	iConf.setFailureBackoff(0);
+
+	if (mysql_library_init(0, NULL, NULL))
+		Logger::bail("Unable to initialize MySQL library");
+
+	vector<BenchThread> t(threads);
+	pthread_barrier_init(&barrier, NULL, threads);
+	for (long i = 0; i < threads; i++) {
+		memset(&t[i], 0, sizeof(t[i]));
+		t[i].id = i;
+		t[i].count = count;
+		t[i].iConf = &iConf;
+		if (pthread_create(&t[i].tid, NULL, bench, &t[i]))
+			Logger::bail("Unable to start the benchmark threads");
+	}
+
+	long errors = 0;
+	for (long i = 0; i < threads; i++) {
+		pthread_join(t[i].tid, NULL);
+		errors += t[i].errors;
+	}
+
+	for (int p = 0; p < PHASES; p++) {
+		double elapsed = 0;
+		long ops = 0;
+
+		for (long i = 0; i < threads; i++) {
+			if (t[i].elapsed[p] > elapsed)
+				elapsed = t[i].elapsed[p];
+			ops += t[i].ops[p];
+		}
+		printf("%-8s %10ld ops %8.3lf s %10.0lf ops/s\n", phase_names[p], ops, elapsed, elapsed > 0 ? ops / elapsed : 0);
+	}
+	if (errors)
+		printf("%ld errors\n", errors);
+
+	pthread_barrier_destroy(&barrier);
+	mysql_library_end();
+	return errors ? 1 : 0;
+}
@@ -43,6 +43,7 @@ using namespace std;
 
 struct UrlPacket {
 	string url;
+	InfernoConf *iConf;
 };
 
 void *thread_function(void *arg);
@@ -61,9 +62,32 @@ int main(int argc, char **argv) {
 
 	pthread_t *t_id;
 
+	InfernoConf iConf;
+	int opt;
+
+	// record origin responses to, or replay them from, an archive directory
+	while ((opt = getopt(argc, argv, "r:R:p:")) != -1) {
+		switch (opt) {
+			case 'r':
+				iConf.setArchiveMode(InfernoConf::ARCHIVE_RECORD);
+				iConf.setArchiveDir(optarg);
+				break;
+			case 'R':
+				iConf.setArchiveMode(InfernoConf::ARCHIVE_REPLAY);
+				iConf.setArchiveDir(optarg);
+				break;
+			case 'p':
+				iConf.setReplayPort(atol(optarg));
+				break;
+			default:
+				argc = 0;
+				break;
+		}
+	}
+
 	// check if argument is given
-	if(argc != 2) {
-		fprintf(stderr, "Usage: %s <url_file>\n", argv[0]);
+	if(argc - optind != 1) {
+		fprintf(stderr, "Usage: %s [-r <archive_dir> | -R <archive_dir> [-p <port>]] <url_file>\n", argv[0]);
 		return 1;
 	}
 
@@ -75,7 +99,7 @@ int main(int argc, char **argv) {
 	//}
 
 	// open file stream
-	fp = fopen(argv[1], "r");
+	fp = fopen(argv[optind], "r");
 	if(fp == NULL) {
 		Logger::bail("Unable to open file based on the supplied argument");
 	}
@@ -130,6 +154,7 @@ int main(int argc, char **argv) {
 		}
 
 		pkt->url = *it;
+		pkt->iConf = &iConf;
 
 		// create new thread for current url
 		res = pthread_create(&(t_id[i]), NULL, thread_function, (void *)pkt);
@@ -173,7 +198,7 @@ void *thread_function(void *arg) {
 	double t1, t2;
 	InfernoConf::Classification retval;
 
-	Multifetch multifetch;
+	Multifetch multifetch(*pkt->iConf);
 
 	fp = fopen("runtime.log", "a");
 	if(fp == NULL) {
@@ -1,13 +1,17 @@
 #include <cerrno>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
 #include "sead.h"
+#include "jpegscan.h"
 #include "logger.h"
 
 using namespace std;
 
 void _usage(char *prog) {
-	cerr << "Usage: " << prog << " [-q label] [-c img_file] <-l log_file>" << endl;
+	cerr << "Usage: " << prog << " [-q label] [-c img_file] [-p scans] <-l log_file>" << endl;
 	exit(1);
 }
 
@@ -19,10 +23,15 @@ int main(int argc, char **argv) {
 	char *label = NULL, *img_file = NULL;
 	ofstream *log_file = NULL;
 	bool needsClose = false;
-	int c;
+	int c, scans = 0;
+	string path;
+	char partial[] = "/tmp/imclassifierXXXXXX";
 
-	while ((c = getopt(argc, argv, "c:l:q:h")) != -1) {
+	while ((c = getopt(argc, argv, "c:l:p:q:h")) != -1) {
 		switch(c) {
+			case 'p':
+				scans = atoi(optarg);
+				break;
 			case 'q':
 				if (!(label = strdup(optarg)))
 					Logger::bail("Unable to allocate memory");
@@ -47,8 +56,32 @@ int main(int argc, char **argv) {
 	if (!img_file || !label || !log_file)
 		usage();
 
+	// extract features from the first scans of a progressive JPEG only, to
+	// assess early classification
+	path = img_file;
+	if (scans > 0) {
+		size_t used, total;
+		int fd;
+
+		if ((fd = mkstemp(partial)) < 0)
+			Logger::bail("Unable to create temporary file");
+		close(fd);
+		if ((fd = open(img_file, O_RDONLY)) < 0) {
+			unlink(partial);
+			Logger::bail("Unable to open %s", img_file);
+		}
+		if (!JpegScanner::truncate(fd, partial, scans, used, total)) {
+			close(fd);
+			unlink(partial);
+			Logger::bail("%s is not a progressive JPEG of %d scans or more", img_file, scans);
+		}
+		close(fd);
+		cerr << img_file << ": " << used << " of " << total << " bytes" << endl;
+		path = partial;
+	}
+
 	errno = 0;
-	if (!sead.init(img_file)) {
+	if (!sead.init(path)) {
 		feature = sead.process();
 		if (!feature) {
 			Logger::error("Got NULL feature");
@@ -58,6 +91,9 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (scans > 0)
+		unlink(partial);
+
 	if (needsClose)
 		delete log_file;
 
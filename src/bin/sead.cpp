@@ -33,6 +33,7 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <mysql.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -46,6 +47,7 @@
 #include "sead.h"
 #include "logger.h"
 #include "dbcache.h"
+#include "dbpool.h"
 #include "mynetlib.h"
 #include "multifetch.h"
 
@@ -67,6 +69,7 @@ typedef struct {
 	string hash; // resource hash
 	string type; // type of resource
 	InfernoConf::FilteringMode f_mode;
+	bool partial; // first scans of an image still being fetched
 } Resource;
 
 typedef struct {
@@ -106,14 +109,15 @@ int frisk_user_request_str(const string& req, Resource& res, InfernoConf*& iConf
 	int pos;
 
 	reqstream >> classify >> res.hash >> oftype >> res.type;
-	if (classify != "CLASSIFY" || oftype != "OFTYPE" || res.hash.empty() || res.type.empty())
+	if ((classify != "CLASSIFY" && classify != "PARTIAL") || oftype != "OFTYPE" || res.hash.empty() || res.type.empty())
 		return -1;
+	res.partial = (classify == "PARTIAL");
 	pos = reqstream.tellg();
 	rest = reqstream.str().substr(pos + 1);
 	iConf = InfernoConf::parseString(rest);
 	if (!iConf)
 		return -1;
-	res.path = iConf->computePathFromHash(res.hash);
+	res.path = iConf->computePathFromHash(res.hash) + (res.partial ? ".partial" : "");
 	res.f_mode = iConf->getFilteringMode();
 
 	return 0;
@@ -157,24 +161,25 @@ double svm_predict_str(double *feature, struct svm_model* model) {
 	return result;
 }
 
-int serve_request(WorkerJob& job) {
+int serve_request(WorkerJob& job, DbCache& cache) {
 	InfernoConf::Classification response = InfernoConf::CLASS_ERROR;
 	Sead::IplImageFeature *feature = NULL;
 	int max_c;
 	bool seadInitFailed = false;
+	UrlRecord record;
+	bool have_record = false;
 
 	string input_feat;
 	stringstream ifstr(input_feat);
 	Sead sead;
 
-	DbCache cache;
-	if (cache.init(*job.iConf)) {
-		Logger::error("Unable to initialize database client");
-		return -1;
-	}
-
 	// check if image loading succeeded
 	if(sead.init(job.resrc.path)) {
+		// the full image will be classified once fetched
+		if (job.resrc.partial) {
+			unlink(job.resrc.path.c_str());
+			return 0;
+		}
 		response = InfernoConf::CLASS_ERROR;
 		seadInitFailed = true;
 	} else {
@@ -253,6 +258,19 @@ int serve_request(WorkerJob& job) {
 					max_c = i;
 		}
 
+		// an early verdict stands only if confident enough, and if the full
+		// image is not being classified already
+		if (job.resrc.partial && (
+					(ret_svm[0] == ret_svm[1] && ret_svm[1] == ret_svm[2]) ||
+					ret_svm[max_c] * 100 < job.iConf->getPartialConfidence() ||
+					!(have_record = cache.lookupUrlRecord(job.resrc.hash, record)) ||
+					record.status != InfernoConf::STATUS_FETCHING)) {
+			Logger::debug("No early verdict for image '%s'", job.resrc.hash.c_str());
+			delete feature;
+			unlink(job.resrc.path.c_str());
+			return 0;
+		}
+
 		switch(max_c) {
 			case 0:
 				Logger::debug("Classifier asserted that the image is PORN");
@@ -273,6 +291,9 @@ int serve_request(WorkerJob& job) {
 
 		if(feature)
 			delete feature;
+	} else if (job.resrc.partial) {
+		unlink(job.resrc.path.c_str());
+		return 0;
 	} else if (!seadInitFailed) { // for some reason the image processing module returned a null feature-vector pointer
 		Logger::debug("classifying as benign!");
 		response = InfernoConf::CLASS_BENIGN;
@@ -301,7 +322,15 @@ int serve_request(WorkerJob& job) {
 		if((job.resrc.f_mode == InfernoConf::F_MODE_IMAGE || job.resrc.f_mode == InfernoConf::F_MODE_MIXED) && (response == InfernoConf::CLASS_PORN || response == InfernoConf::CLASS_BIKINI)) {
 			if (sead.blur())
 				Logger::error("Sead::blur()");
-			if (cache.lookupUrlContentType(job.resrc.hash) != "image/jpeg" && !cache.updateUrlContentType(job.resrc.hash, "image/jpeg")) {
+			// the blurred early version replaces the image being fetched
+			if (job.resrc.partial && rename(job.resrc.path.c_str(), job.iConf->computePathFromHash(job.resrc.hash).c_str())) {
+				Logger::error("rename");
+				response = InfernoConf::CLASS_ERROR;
+			}
+			// the entry was looked up already if this is an early verdict
+			if (!have_record)
+				cache.lookupUrlRecord(job.resrc.hash, record);
+			if (record.ctype != "image/jpeg" && !cache.updateUrlContentType(job.resrc.hash, "image/jpeg")) {
 				Logger::error("Error updating blurred image content type. Error report: %s", cache.getErrorString());
 				response = InfernoConf::CLASS_ERROR;
 			}
@@ -318,9 +347,14 @@ int serve_request(WorkerJob& job) {
 			response = InfernoConf::CLASS_ERROR;
 		}
 	}
+	if (job.resrc.partial)
+		unlink(job.resrc.path.c_str());
 	if (response == InfernoConf::CLASS_ERROR) {
+		// the full image will be classified once fetched
+		if (job.resrc.partial)
+			return -1;
 		Logger::debug("Updating image status for '%s' to 'FAILURE'", job.resrc.hash.c_str());
-		if(!cache.updateUrlStatus(job.resrc.hash, InfernoConf::STATUS_FAILURE)) {
+		if(!cache.updateUrlFailure(job.resrc.hash, seadInitFailed ? "undecodable image" : "classification failed")) {
 			Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", cache.getErrorString());
 		}
 		return -1;
@@ -440,8 +474,14 @@ void *worker_main(void *arg) {
 		sem_post(&mutex);
 
 		// process request and close remote endpoint
-		if(serve_request(*job) == -1)
-			Logger::error("Error serving client request");
+		DbCache *cache = DbPool::checkout(*job->iConf);
+		if (!cache)
+			Logger::error("Unable to initialize database client");
+		else {
+			if(serve_request(*job, *cache) == -1)
+				Logger::error("Error serving client request");
+			DbPool::checkin(cache);
+		}
 
 		// free job space
 		if (job->endpoint)
@@ -604,13 +644,16 @@ cleanup:
 	Logger::debug("Destroying shared queue resource");
 	bool cacheCleaned = false;
 	while (!reqs.empty()) {
-		DbCache cache;
 		WorkerJob* front = reqs.front();
 		reqs.pop();
 		// XXX: Assuming that state for all requests is stored in the same database
-		if (!cacheCleaned && !cache.init(*front->iConf)) {
-			cache.fixCache();
-			cacheCleaned = true;
+		if (!cacheCleaned) {
+			DbCache *cache = DbCache::create(*front->iConf);
+			if (!cache->init(*front->iConf)) {
+				cache->fixCache();
+				cacheCleaned = true;
+			}
+			delete cache;
 		}
 		delete front;
 	}
@@ -0,0 +1,183 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+
+#include <strings.h>
+
+#include "cssparse.h"
+#include "htmlparse.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const size_t CSSParser::MAX_SIZE = 1024 * 1024;
+const size_t CSSParser::MAX_ENTRIES = 1024;
+
+map<string, CSSParser::Entry> CSSParser::entries;
+pthread_mutex_t CSSParser::lock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+//  libcroco property callback function
+//
+void CSSParser::Property(CRDocHandler *handler, CRString *name, CRTerm *expression, gboolean important) {
+	Context *ctx = (Context *)handler->app_data;
+	(void)important;
+
+	if (!name || !name->stryng || !name->stryng->str)
+		return;
+
+	// images may be given on their own or along with the rest of the
+	// background (as in 'background: #fff url(a.png) no-repeat')
+	if (strcasecmp(name->stryng->str, "background-image") && strcasecmp(name->stryng->str, "background"))
+		return;
+
+	for (CRTerm *term = expression; term; term = term->next) {
+		if (term->type != TERM_URI || !term->content.str || !term->content.str->stryng)
+			continue;
+
+		const char *uri = term->content.str->stryng->str;
+		if (!uri || !*uri || !strncasecmp(uri, "data:", 5))
+			continue;
+		ctx->url_list->insert(HTMLParser::recompose_url(ctx->base_url, uri));
+	}
+}
+
+/**
+ * Collects the images referenced by the given stylesheet, resolved
+ * against the URL the stylesheet was fetched from.
+ */
+void CSSParser::parseCss(const string& css, const string& baseUrl, set<string>& url_list) {
+	CRParser *parser;
+	CRDocHandler *handler;
+	Context ctx;
+
+	if (css.empty())
+		return;
+
+	ctx.url_list = &url_list;
+	ctx.base_url = baseUrl;
+
+	// the parser only reads the buffer; it is left to the caller to free
+	if (!(parser = cr_parser_new_from_buf((guchar *)css.data(), (gulong)css.length(), CR_UTF_8, FALSE))) {
+		Logger::error("cr_parser_new_from_buf");
+		return;
+	}
+
+	if (!(handler = cr_doc_handler_new())) {
+		Logger::error("cr_doc_handler_new");
+		cr_parser_destroy(parser);
+		return;
+	}
+
+	handler->app_data = &ctx;
+	handler->property = Property;
+
+	cr_parser_set_sac_handler(parser, handler);
+	if (cr_parser_parse(parser) != CR_OK)
+		Logger::debug("Errors parsing stylesheet of %s", baseUrl.c_str());
+
+	cr_parser_destroy(parser);
+	cr_doc_handler_unref(handler);
+}
+
+/**
+ * Same as parseCss(), for a stylesheet stored in a file. libcroco has no
+ * incremental interface, so the file is read whole, in chunks.
+ */
+void CSSParser::parseCssFile(const string& cssPath, const string& baseUrl, set<string>& url_list) {
+	string css;
+	char buf[4096];
+	size_t nread;
+	FILE *fp;
+
+	if (!(fp = fopen(cssPath.c_str(), "rb"))) {
+		Logger::error("fopen");
+		return;
+	}
+
+	while ((nread = fread(buf, 1, sizeof(buf), fp)) > 0 && css.length() < MAX_SIZE)
+		css.append(buf, nread);
+	fclose(fp);
+
+	if (css.length() >= MAX_SIZE) {
+		Logger::warn("Stylesheet %s too large. Skipping...", cssPath.c_str());
+		return;
+	}
+	parseCss(css, baseUrl, url_list);
+}
+
+/**
+ * Collects the images referenced by the declarations of a style attribute.
+ */
+void CSSParser::parseStyle(const string& style, const string& baseUrl, set<string>& url_list) {
+	if (style.find("url(") == string::npos && style.find("URL(") == string::npos)
+		return;
+	parseCss("x{" + style + "}", baseUrl, url_list);
+}
+
+void CSSParser::prune(time_t now) {
+	for (map<string, Entry>::iterator it = entries.begin(); it != entries.end(); ) {
+		if (it->second.expires <= now)
+			entries.erase(it++);
+		else
+			it++;
+	}
+
+	// still too many; drop arbitrary ones rather than grow unbounded
+	while (entries.size() >= MAX_ENTRIES)
+		entries.erase(entries.begin());
+}
+
+/**
+ * Adds the cached images of the given stylesheet to the list. Returns
+ * false if the stylesheet is not in the cache, or its entry has expired.
+ */
+bool CSSParser::lookup(const string& url, set<string>& url_list) {
+	bool ret = false;
+
+	pthread_mutex_lock(&lock);
+	map<string, Entry>::iterator it = entries.find(url);
+	if (it != entries.end() && it->second.expires > time(NULL)) {
+		url_list.insert(it->second.images.begin(), it->second.images.end());
+		ret = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+void CSSParser::store(const string& url, const set<string>& images, long ttl) {
+	time_t now = time(NULL);
+
+	if (ttl <= 0)
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (entries.size() >= MAX_ENTRIES)
+		prune(now);
+	Entry& e = entries[url];
+	e.images.assign(images.begin(), images.end());
+	e.expires = now + ttl;
+	pthread_mutex_unlock(&lock);
+}
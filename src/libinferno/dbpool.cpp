@@ -0,0 +1,137 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <mysql.h>
+
+#include "dbpool.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const size_t DbPool::MAX_IDLE = 16;
+
+vector<DbCache*> DbPool::idle;
+pthread_mutex_t DbPool::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t DbPool::thread_key;
+pthread_once_t DbPool::key_once = PTHREAD_ONCE_INIT;
+
+bool DbPool::sameServer(const InfernoConf& a, const InfernoConf& b) {
+	if (a.getCacheBackend() != b.getCacheBackend() || a.getDirectory() != b.getDirectory())
+		return false;
+	if (a.getCacheBackend() == InfernoConf::BACKEND_LOCAL)
+		return a.getLocalStore() == b.getLocalStore();
+	return a.getHostname() == b.getHostname() && a.getStore() == b.getStore() &&
+		a.getUsername() == b.getUsername() && a.getPassword() == b.getPassword();
+}
+
+void DbPool::makeKey() {
+	pthread_key_create(&thread_key, endThread);
+}
+
+void DbPool::endThread(void *arg) {
+	(void)arg;
+	mysql_thread_end();
+}
+
+/**
+ * Sets up the MySQL client library for the calling thread, unless done
+ * already; connections may be handed over between threads.
+ */
+void DbPool::initThread() {
+	pthread_once(&key_once, makeKey);
+	if (pthread_getspecific(thread_key))
+		return;
+
+	mysql_thread_init();
+	pthread_setspecific(thread_key, (void *)1);
+}
+
+/**
+ * Hands out an idle connection to the cache server of the given
+ * configuration, or a new one if there is none. The connection is not
+ * checked here; DbCache::reconnect() does so lazily, if it has been idle
+ * for long or has failed.
+ *
+ * Returns: the connection, or NULL on error
+ */
+DbCache* DbPool::checkout(const InfernoConf& conf) {
+	DbCache *cache = NULL;
+
+	initThread();
+
+	pthread_mutex_lock(&lock);
+	for (vector<DbCache*>::iterator it = idle.begin(); it != idle.end(); it++) {
+		if (sameServer((*it)->getInfernoConf(), conf)) {
+			cache = *it;
+			idle.erase(it);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (cache) {
+		// pick up settings other than those of the server, such as back-off
+		cache->setInfernoConf(conf);
+		return cache;
+	}
+
+	cache = DbCache::create(conf);
+	if (cache->init(conf) || !cache->connect()) {
+		Logger::error("Could not connect to caching server. Error report: %s", cache->getErrorString());
+		delete cache;
+		return NULL;
+	}
+	return cache;
+}
+
+/**
+ * Returns a connection to the pool, or closes it if enough are idle.
+ */
+void DbPool::checkin(DbCache *cache) {
+	if (!cache)
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (idle.size() < MAX_IDLE) {
+		idle.push_back(cache);
+		cache = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (cache)
+		delete cache;
+}
+
+/**
+ * Closes all idle connections.
+ */
+void DbPool::clear() {
+	vector<DbCache*> closing;
+
+	pthread_mutex_lock(&lock);
+	closing.swap(idle);
+	pthread_mutex_unlock(&lock);
+
+	for (vector<DbCache*>::iterator it = closing.begin(); it != closing.end(); it++)
+		delete *it;
+}
@@ -0,0 +1,225 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <uriparser/Uri.h>
+
+#include "dnscache.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const int DnsCache::MAX_RESOLVERS = 32;
+const size_t DnsCache::MAX_ENTRIES = 4096;
+
+map<string, DnsCache::Entry> DnsCache::entries;
+pthread_mutex_t DnsCache::lock = PTHREAD_MUTEX_INITIALIZER;
+int DnsCache::resolvers = 0;
+
+/**
+ * Extracts the host name and port (explicit or implied by the scheme) out
+ * of an absolute URL. Returns false for URLs naming an IP literal, as
+ * these need no resolving.
+ */
+bool DnsCache::splitUrl(const string& url, string& host, string& port) {
+	UriParserStateA state;
+	UriUriA uri;
+	string scheme;
+	struct in_addr in4;
+
+	state.uri = &uri;
+	if (uriParseUriA(&state, url.c_str()) != URI_SUCCESS) {
+		uriFreeUriMembersA(&uri);
+		return false;
+	}
+
+	if (uri.hostText.first)
+		host.assign(uri.hostText.first, uri.hostText.afterLast);
+	if (uri.portText.first)
+		port.assign(uri.portText.first, uri.portText.afterLast);
+	if (uri.scheme.first)
+		scheme.assign(uri.scheme.first, uri.scheme.afterLast);
+	uriFreeUriMembersA(&uri);
+
+	if (host.empty() || host.find(':') != string::npos || inet_pton(AF_INET, host.c_str(), &in4) == 1)
+		return false;
+
+	if (port.empty()) {
+		if (!strcasecmp(scheme.c_str(), "http"))
+			port = "80";
+		else if (!strcasecmp(scheme.c_str(), "https"))
+			port = "443";
+		else
+			return false;
+	}
+	return true;
+}
+
+void* DnsCache::resolve(void *arg) {
+	Job *job = (Job *)arg;
+	struct addrinfo hints, *res = NULL, *cur;
+	vector<string> addrs;
+	char buf[INET6_ADDRSTRLEN];
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+
+	if ((err = getaddrinfo(job->host.c_str(), NULL, &hints, &res)))
+		Logger::debug("Pre-resolving %s failed: %s", job->host.c_str(), gai_strerror(err));
+
+	for (cur = res; cur; cur = cur->ai_next) {
+		string addr;
+		if (cur->ai_family == AF_INET &&
+				inet_ntop(AF_INET, &((struct sockaddr_in *)cur->ai_addr)->sin_addr, buf, sizeof(buf)))
+			addr = buf;
+		else if (cur->ai_family == AF_INET6 &&
+				inet_ntop(AF_INET6, &((struct sockaddr_in6 *)cur->ai_addr)->sin6_addr, buf, sizeof(buf)))
+			addr = string("[") + buf + "]";
+		if (!addr.empty() && find(addrs.begin(), addrs.end(), addr) == addrs.end())
+			addrs.push_back(addr);
+	}
+	if (res)
+		freeaddrinfo(res);
+
+	pthread_mutex_lock(&lock);
+	Entry& entry = entries[job->host];
+	entry.addrs = addrs;
+	entry.pending = false;
+	// negative answers are only kept for a short while
+	entry.expires = time(NULL) + (addrs.empty() ? 1 : job->ttl);
+	resolvers--;
+	pthread_mutex_unlock(&lock);
+
+	delete job;
+	return NULL;
+}
+
+void DnsCache::prune(time_t now) {
+	for (map<string, Entry>::iterator it = entries.begin(); it != entries.end(); ) {
+		if (!it->second.pending && it->second.expires <= now)
+			entries.erase(it++);
+		else
+			it++;
+	}
+}
+
+/**
+ * Starts resolving the distinct hosts of the given URLs concurrently, for
+ * those not already cached. Returns without waiting for the answers.
+ */
+void DnsCache::prefetch(const set<string>& urls, long ttl) {
+	set<string> hosts;
+	time_t now = time(NULL);
+
+	if (ttl <= 0)
+		return;
+
+	for (set<string>::const_iterator it = urls.begin(); it != urls.end(); it++) {
+		string host, port;
+		if (splitUrl(*it, host, port))
+			hosts.insert(host);
+	}
+
+	pthread_mutex_lock(&lock);
+	if (entries.size() > MAX_ENTRIES)
+		prune(now);
+
+	for (set<string>::iterator it = hosts.begin(); it != hosts.end() && resolvers < MAX_RESOLVERS; it++) {
+		map<string, Entry>::iterator eit = entries.find(*it);
+		if (eit != entries.end() && (eit->second.pending || eit->second.expires > now))
+			continue;
+
+		Job *job = new Job;
+		pthread_t tid;
+		pthread_attr_t attr;
+
+		job->host = *it;
+		job->ttl = ttl;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&tid, &attr, resolve, job)) {
+			Logger::debug("pthread_create");
+			delete job;
+		} else {
+			Entry& entry = entries[*it];
+			entry.pending = true;
+			resolvers++;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	pthread_mutex_unlock(&lock);
+
+	Logger::debug("Pre-resolving %d distinct hosts", (int)hosts.size());
+}
+
+/**
+ * Returns the cached addresses of the given host, if any and still fresh.
+ */
+bool DnsCache::lookup(const string& host, vector<string>& addrs) {
+	bool found = false;
+
+	pthread_mutex_lock(&lock);
+	map<string, Entry>::iterator it = entries.find(host);
+	if (it != entries.end() && !it->second.pending &&
+			it->second.expires > time(NULL) && !it->second.addrs.empty()) {
+		addrs = it->second.addrs;
+		found = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+/**
+ * Appends a CURLOPT_RESOLVE entry for the host of the given URL to list,
+ * if its addresses are already known. The address list is rotated by the
+ * given number of places, so that retries can go to a different address.
+ * Returns the (possibly new) list.
+ */
+struct curl_slist* DnsCache::resolveList(const string& url, struct curl_slist* list, int rotate) {
+	string host, port, entry;
+	vector<string> addrs;
+
+	if (!splitUrl(url, host, port) || !lookup(host, addrs))
+		return list;
+
+	entry = host + ":" + port + ":";
+	for (size_t i = 0; i < addrs.size(); i++) {
+		if (i)
+			entry.push_back(',');
+		entry.append(addrs[(i + rotate) % addrs.size()]);
+	}
+	return curl_slist_append(list, entry.c_str());
+}
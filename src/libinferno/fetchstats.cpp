@@ -0,0 +1,334 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+
+#include <sys/time.h>
+
+#include "fetchstats.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const size_t FetchStats::SAMPLES = 256;
+const size_t FetchStats::MIN_SAMPLES = 20;
+const double FetchStats::INITIAL_WINDOW = 4.0;
+const double FetchStats::MAX_WINDOW = 1024.0;
+const double FetchStats::LATENCY_INFLATION = 2.0;
+const size_t FetchStats::MAX_ORIGINS = 1024;
+const double FetchStats::ORIGIN_TTL = 300.0;
+const double FetchStats::RATE_INTERVAL = 1.0;
+const double FetchStats::RATE_GAIN = 0.1;
+const double FetchStats::REPORT_INTERVAL = 60.0;
+
+vector<double> FetchStats::durations;
+size_t FetchStats::next = 0;
+long FetchStats::transfers = 0;
+long FetchStats::hedges = 0;
+double FetchStats::window = FetchStats::INITIAL_WINDOW;
+double FetchStats::ssthresh = FetchStats::MAX_WINDOW;
+long FetchStats::inflight = 0;
+map<string, FetchStats::Origin> FetchStats::origins;
+double FetchStats::srtt = -1;
+double FetchStats::rate_start = 0;
+double FetchStats::rate_bytes = 0;
+double FetchStats::best_rate = 0;
+double FetchStats::best_window = 0;
+double FetchStats::last_cut = 0;
+double FetchStats::last_report = 0;
+long FetchStats::early_verdicts = 0;
+double FetchStats::bytes_saved = 0;
+double FetchStats::bytes_fetched = 0;
+pthread_mutex_t FetchStats::lock = PTHREAD_MUTEX_INITIALIZER;
+
+double FetchStats::now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Accounts for a newly started (non-hedged) transfer.
+ */
+void FetchStats::recordTransfer() {
+	pthread_mutex_lock(&lock);
+	// age the counters so that the hedge budget follows recent traffic
+	if (++transfers > 1000) {
+		transfers /= 2;
+		hedges /= 2;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Records the duration of a successful transfer.
+ */
+void FetchStats::recordFetch(double secs) {
+	pthread_mutex_lock(&lock);
+	if (durations.size() < SAMPLES)
+		durations.push_back(secs);
+	else
+		durations[next] = secs;
+	next = (next + 1) % SAMPLES;
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Computes the pct-th percentile of the recent transfer durations. Returns
+ * false if there are too few samples to go by.
+ */
+bool FetchStats::percentile(long pct, double& value) {
+	vector<double> samples;
+
+	if (pct <= 0 || pct > 100)
+		return false;
+
+	pthread_mutex_lock(&lock);
+	samples = durations;
+	pthread_mutex_unlock(&lock);
+
+	if (samples.size() < MIN_SAMPLES)
+		return false;
+
+	size_t idx = (samples.size() - 1) * pct / 100;
+	nth_element(samples.begin(), samples.begin() + idx, samples.end());
+	value = samples[idx];
+	return true;
+}
+
+/**
+ * Grants a hedged request if hedges stay below ratio percent of the
+ * recent transfers, so that hedging cannot amplify load on the origins.
+ */
+bool FetchStats::acquireHedge(long ratio) {
+	bool granted = false;
+
+	pthread_mutex_lock(&lock);
+	if ((hedges + 1) * 100 <= transfers * ratio) {
+		hedges++;
+		granted = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return granted;
+}
+
+/**
+ * Grants a transfer slot if the number of transfers in flight is below the
+ * current window (and max, if positive). Forced requests are always granted,
+ * so that every request gets at least one transfer going.
+ */
+bool FetchStats::acquireSlot(long max, bool force) {
+	bool granted = false;
+
+	pthread_mutex_lock(&lock);
+	if (max > 0 && window > max)
+		window = max;
+	if (force || inflight < (long)window) {
+		inflight++;
+		granted = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return granted;
+}
+
+// Halves the window, at most once per smoothed latency so that a burst of
+// failures of the same round does not collapse it; called with lock held.
+void FetchStats::cutWindow(double now) {
+	if (now - last_cut < max(srtt, 0.1))
+		return;
+	last_cut = now;
+	ssthresh = max(window / 2, 1.0);
+	window = ssthresh;
+	Logger::debug("Transfer window cut to %.1lf (%ld in flight)", window, inflight);
+}
+
+// Folds the latency of a response into the statistics of its origin
+// server, and tells whether the latter is inflated over the baseline of
+// that server; called with lock held.
+bool FetchStats::inflated(const string& origin, double latency, double now) {
+	map<string, Origin>::iterator it = origins.find(origin);
+
+	if (it == origins.end()) {
+		if (origins.size() >= MAX_ORIGINS) {
+			for (map<string, Origin>::iterator oit = origins.begin(); oit != origins.end(); )
+				if (now - oit->second.used > ORIGIN_TTL)
+					origins.erase(oit++);
+				else
+					oit++;
+			if (origins.size() >= MAX_ORIGINS)
+				origins.clear();
+		}
+		Origin o;
+		o.base_latency = o.srtt = latency;
+		it = origins.insert(make_pair(origin, o)).first;
+	}
+	Origin& o = it->second;
+
+	// the baseline follows the fastest responses, but slowly drifts
+	// upwards so that it recovers from a transient low
+	if (latency < o.base_latency)
+		o.base_latency = latency;
+	else
+		o.base_latency += (latency - o.base_latency) / 64;
+	o.srtt += (latency - o.srtt) / 8;
+	o.used = now;
+
+	// the smoothed latency of all servers paces the window cuts
+	srtt = (srtt < 0) ? latency : srtt + (latency - srtt) / 8;
+
+	return o.srtt > LATENCY_INFLATION * o.base_latency + 0.05;
+}
+
+// Samples the rate at which data comes in, remembering the best one and
+// the window it was reached with; called with lock held.
+void FetchStats::sampleRate(double now) {
+	double rate;
+
+	if (rate_start <= 0) {
+		rate_start = now;
+		rate_bytes = bytes_fetched;
+		return;
+	}
+	if (now - rate_start < RATE_INTERVAL)
+		return;
+
+	rate = (bytes_fetched - rate_bytes) / (now - rate_start);
+	rate_start = now;
+	rate_bytes = bytes_fetched;
+
+	// the best rate fades slowly, so that it is learnt anew as the
+	// traffic changes
+	best_rate -= best_rate / 1024;
+	if (rate > best_rate * (1 + RATE_GAIN)) {
+		best_rate = rate;
+		best_window = window;
+	}
+}
+
+/**
+ * Returns a slot acquired with acquireSlot() and adjusts the window on the
+ * outcome of the transfer. latency is the time the origin server took to
+ * start responding, if known.
+ */
+void FetchStats::releaseSlot(Outcome outcome, double latency, const string& origin) {
+	double now = FetchStats::now();
+	bool report = false;
+	double cur_window, cur_saved, cur_rate;
+	long cur_inflight, cur_verdicts;
+
+	pthread_mutex_lock(&lock);
+	if (inflight > 0)
+		inflight--;
+
+	if (outcome == OUTCOME_OK && latency > 0 && inflated(origin, latency, now))
+		outcome = OUTCOME_CONGESTED;
+	sampleRate(now);
+
+	switch (outcome) {
+		case OUTCOME_OK:
+			// a window twice as large as the one the best throughput was
+			// reached with, without doing better, is large enough
+			if (best_window > 0 && window >= 2 * best_window)
+				break;
+			// grow by one slot per success below ssthresh, by one slot per
+			// window worth of successes above it
+			if (window < ssthresh)
+				window += 1;
+			else
+				window += 1 / window;
+			if (window > MAX_WINDOW)
+				window = MAX_WINDOW;
+			break;
+		case OUTCOME_CONGESTED:
+			cutWindow(now);
+			break;
+		case OUTCOME_NEUTRAL:
+		default:
+			break;
+	}
+
+	if (now - last_report >= REPORT_INTERVAL) {
+		last_report = now;
+		report = true;
+	}
+	cur_window = window;
+	cur_inflight = inflight;
+	cur_verdicts = early_verdicts;
+	cur_saved = bytes_saved;
+	cur_rate = best_rate;
+	pthread_mutex_unlock(&lock);
+
+	if (report)
+		Logger::info("Transfer window: %.1lf, in flight: %ld, best rate: %.0lf B/s, early verdicts: %ld, bytes saved: %.0lf",
+				cur_window, cur_inflight, cur_rate, cur_verdicts, cur_saved);
+}
+
+/**
+ * Accounts for a transfer aborted after its partial data was classified,
+ * saving the given number of bytes (0 if unknown).
+ */
+void FetchStats::recordEarlyVerdict(double saved) {
+	pthread_mutex_lock(&lock);
+	early_verdicts++;
+	bytes_saved += saved;
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Accounts for data received from origin servers.
+ */
+void FetchStats::recordBytes(size_t len) {
+	pthread_mutex_lock(&lock);
+	bytes_fetched += len;
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Returns the total number of bytes received from origin servers.
+ */
+double FetchStats::getBytes() {
+	double ret;
+
+	pthread_mutex_lock(&lock);
+	ret = bytes_fetched;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+double FetchStats::getWindow() {
+	double ret;
+
+	pthread_mutex_lock(&lock);
+	ret = window;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+long FetchStats::getInflight() {
+	long ret;
+
+	pthread_mutex_lock(&lock);
+	ret = inflight;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
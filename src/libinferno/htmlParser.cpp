@@ -20,8 +20,12 @@
  */
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
+#include <strings.h>
+
 #include <uriparser/UriBase.h>
 #include <uriparser/UriDefsAnsi.h>
 #include <uriparser/UriDefsConfig.h>
@@ -29,28 +33,261 @@
 #include <uriparser/Uri.h>
 #include <uriparser/UriIp4.h>
 
+#include "cssparse.h"
 #include "htmlparse.h"
+#include "infernoconf.h"
 #include "logger.h"
 #include "config.h"
 
 using namespace std;
 
+const char* HTMLParser::getAttribute(const xmlChar **attributes, const char *name) {
+	for (int i = 0; attributes && attributes[i] != NULL; i += 2) {
+		if (!strcasecmp((char *)attributes[i], name))
+			return (const char *)attributes[i + 1];
+	}
+	return NULL;
+}
+
+bool HTMLParser::hasAttribute(const xmlChar **attributes, const char *name) {
+	for (int i = 0; attributes && attributes[i] != NULL; i += 2) {
+		if (!strcasecmp((char *)attributes[i], name))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Tells whether the classifier can handle images of the given MIME type.
+ */
+bool HTMLParser::isSupportedType(const char *type) {
+	for (int k = 0; InfernoConf::img_mimes[k] != NULL; k++) {
+		if (!strcasecmp(type, InfernoConf::img_mimes[k]))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Returns the widest slot (in CSS pixels) of a sizes attribute, or 0 if no
+ * slot is given in pixels. Media conditions are not evaluated, as we are
+ * after any variant big enough to classify rather than the one a given
+ * viewport would show.
+ */
+long HTMLParser::parseSizes(const char *sizes) {
+	long ret = 0;
+	string s = (sizes ? sizes : "");
+	size_t start = 0;
+
+	while (start < s.size()) {
+		size_t end = s.find(',', start);
+		if (end == string::npos)
+			end = s.size();
+
+		// the slot size is the last token of each entry
+		string entry = s.substr(start, end - start);
+		size_t last = entry.find_last_not_of(" \t\r\n");
+		if (last != string::npos) {
+			size_t first = entry.find_last_of(" \t\r\n)", last);
+			first = (first == string::npos) ? 0 : first + 1;
+			string len = entry.substr(first, last - first + 1);
+			char *unit;
+			double val = strtod(len.c_str(), &unit);
+			if (unit != len.c_str() && !strcasecmp(unit, "px") && val > ret)
+				ret = (long)val;
+		}
+		start = end + 1;
+	}
+	return ret;
+}
+
+/**
+ * Appends the candidates of a srcset attribute, resolved against the base
+ * URL of the page. Width descriptors are taken as is; density descriptors
+ * are turned into widths through slot, when the latter is known.
+ */
+void HTMLParser::parseSrcset(const Context *ctx, const char *srcset, long slot, vector<Candidate>& candidates) {
+	string s = (srcset ? srcset : "");
+	size_t pos = 0;
+
+	while (pos < s.size()) {
+		pos = s.find_first_not_of(" \t\r\n,", pos);
+		if (pos == string::npos)
+			break;
+
+		size_t end = s.find_first_of(" \t\r\n", pos);
+		if (end == string::npos)
+			end = s.size();
+		string url = s.substr(pos, end - pos);
+		string descriptor;
+		pos = end;
+
+		// a trailing comma ends a candidate without descriptors
+		if (url[url.size() - 1] == ',')
+			url.erase(url.find_last_not_of(',') + 1);
+		else {
+			end = s.find(',', pos);
+			if (end == string::npos)
+				end = s.size();
+			descriptor = s.substr(pos, end - pos);
+			pos = end;
+		}
+
+		if (url.empty() || !strncasecmp(url.c_str(), "data:", 5))
+			continue;
+
+		Candidate c;
+		char *unit;
+		double val = strtod(descriptor.c_str(), &unit);
+
+		while (*unit == ' ' || *unit == '\t')
+			unit++;
+		c.url = recompose_url(ctx->global_base_prefix, url);
+		if (unit != descriptor.c_str() && (*unit == 'w' || *unit == 'W'))
+			c.width = (long)val;
+		else if (unit != descriptor.c_str() && (*unit == 'x' || *unit == 'X'))
+			c.width = (long)(slot * val);
+		else
+			c.width = slot; // no descriptor means 1x
+		candidates.push_back(c);
+	}
+}
+
+/**
+ * Picks the smallest candidate that is at least min_width pixels wide, or
+ * the widest one if none is. Candidates of unknown width are only picked
+ * if no width is known at all, the first one taking precedence.
+ */
+string HTMLParser::pickCandidate(const vector<Candidate>& candidates, long min_width) {
+	const Candidate *best = NULL;
+
+	for (vector<Candidate>::const_iterator cit = candidates.begin(); cit != candidates.end(); cit++) {
+		if (cit->width <= 0)
+			continue;
+		if (!best)
+			best = &(*cit);
+		else if (best->width < min_width)
+			best = (cit->width > best->width) ? &(*cit) : best;
+		else if (cit->width >= min_width && cit->width < best->width)
+			best = &(*cit);
+	}
+
+	if (!best && !candidates.empty())
+		best = &candidates[0];
+	return (best ? best->url : "");
+}
+
+/**
+ * Returns the lower-cased host part of an http(s) URL, or an empty string
+ * for any other URL.
+ */
+string HTMLParser::hostOf(const string& url) {
+	string::size_type start, end;
+
+	if (!strncasecmp(url.c_str(), "http://", 7))
+		start = 7;
+	else if (!strncasecmp(url.c_str(), "https://", 8))
+		start = 8;
+	else
+		return "";
+
+	end = url.find_first_of(":/?#", start);
+	string host = url.substr(start, (end == string::npos) ? string::npos : end - start);
+	// skip any user info
+	string::size_type at = host.rfind('@');
+	if (at != string::npos)
+		host.erase(0, at + 1);
+	transform(host.begin(), host.end(), host.begin(), ::tolower);
+	return host;
+}
+
+/**
+ * Collects the target of an anchor, if it is a page on the same site as
+ * the one being parsed. Fragments are dropped, as they point to the same
+ * page.
+ */
+void HTMLParser::addLink(Context *ctx, const xmlChar **attributes) {
+	const char *href = getAttribute(attributes, "HREF");
+	const char *rel = getAttribute(attributes, "REL");
+
+	if (!href || !*href || *href == '#' || hasAttribute(attributes, "DOWNLOAD"))
+		return;
+	if (rel && strcasestr(rel, "nofollow"))
+		return;
+
+	string link = recompose_url(ctx->global_base_prefix, href);
+	string::size_type pos = link.find('#');
+	if (pos != string::npos)
+		link.erase(pos);
+
+	if (!link.empty() && hostOf(link) == ctx->host)
+		ctx->link_list->insert(link);
+}
+
 //
 //  libxml start element callback function
 //
 void HTMLParser::StartElement(void *voidContext, const xmlChar *name, const xmlChar **attributes) {
 	Context *ctx = (Context*)voidContext;
+	const char *style = getAttribute(attributes, "STYLE");
 
-	if (!strcasecmp((char *)name, "IMG")) {
-		string buff;
-		for(int i = 0; attributes[i] != NULL; i++) {
-			if(!strcasecmp((char *)attributes[i], "SRC")) {
-				buff.append(recompose_url(ctx->global_base_prefix, (char *)attributes[i + 1]));
-			}
+	// images set inline, as in style="background-image: url(a.jpg)"
+	if (style && *style)
+		CSSParser::parseStyle(style, ctx->global_base_prefix, *ctx->url_list);
+
+	if (!strcasecmp((char *)name, "PICTURE")) {
+		ctx->in_picture = true;
+		ctx->sources.clear();
+	} else if (!strcasecmp((char *)name, "SOURCE") && ctx->in_picture) {
+		const char *type = getAttribute(attributes, "TYPE");
+
+		// skip variants in formats the classifier cannot decode
+		if (type && *type && !isSupportedType(type))
+			return;
+		parseSrcset(ctx, getAttribute(attributes, "SRCSET"), parseSizes(getAttribute(attributes, "SIZES")), ctx->sources);
+	} else if (!strcasecmp((char *)name, "IMG")) {
+		vector<Candidate> candidates;
+		const char *src = getAttribute(attributes, "SRC");
+		const char *srcset = getAttribute(attributes, "SRCSET");
+		const char *width = getAttribute(attributes, "WIDTH");
+		long slot = parseSizes(getAttribute(attributes, "SIZES"));
+
+		if (!slot && width)
+			slot = atol(width);
+
+		// lazy-loading scripts keep the real image aside and use src for
+		// a placeholder
+		if (!src || !*src || !strncasecmp(src, "data:", 5)) {
+			if (!(src = getAttribute(attributes, "DATA-SRC")))
+				src = getAttribute(attributes, "DATA-ORIGINAL");
 		}
+		if (!srcset)
+			srcset = getAttribute(attributes, "DATA-SRCSET");
 
+		if (ctx->in_picture)
+			candidates = ctx->sources;
+		parseSrcset(ctx, srcset, slot, candidates);
+		if (src && *src && strncasecmp(src, "data:", 5)) {
+			Candidate c;
+			c.url = recompose_url(ctx->global_base_prefix, src);
+			c.width = (width ? atol(width) : 0);
+			candidates.push_back(c);
+		}
+
+		string buff = pickCandidate(candidates, ctx->min_width);
 		if (!buff.empty())
 			ctx->url_list->insert(buff);
+	} else if (!strcasecmp((char *)name, "A") && ctx->link_list) {
+		addLink(ctx, attributes);
+	} else if (!strcasecmp((char *)name, "LINK") && ctx->css_list) {
+		const char *rel = getAttribute(attributes, "REL");
+		const char *href = getAttribute(attributes, "HREF");
+
+		if (rel && href && *href && strcasestr(rel, "stylesheet") && !strcasestr(rel, "alternate"))
+			ctx->css_list->insert(recompose_url(ctx->global_base_prefix, href));
+	} else if (!strcasecmp((char *)name, "STYLE")) {
+		ctx->in_style = true;
+		ctx->style.clear();
 	}
 }
 
@@ -58,8 +295,26 @@ void HTMLParser::StartElement(void *voidContext, const xmlChar *name, const xmlC
 //  libxml end element callback function
 //
 void HTMLParser::EndElement(void *voidContext, const xmlChar *name) {
-	(void)voidContext;
-	(void)name;
+	Context *ctx = (Context*)voidContext;
+
+	if (!strcasecmp((char *)name, "PICTURE")) {
+		ctx->in_picture = false;
+		ctx->sources.clear();
+	} else if (!strcasecmp((char *)name, "STYLE") && ctx->in_style) {
+		CSSParser::parseCss(ctx->style, ctx->global_base_prefix, *ctx->url_list);
+		ctx->in_style = false;
+		ctx->style.clear();
+	}
+}
+
+//
+//  libxml character data callback function; only <style> contents are kept
+//
+void HTMLParser::Characters(void *voidContext, const xmlChar *chars, int len) {
+	Context *ctx = (Context*)voidContext;
+
+	if (ctx->in_style && ctx->style.length() < CSSParser::MAX_SIZE)
+		ctx->style.append((const char *)chars, len);
 }
 
 const htmlSAXHandler HTMLParser::saxHandler = {
@@ -80,7 +335,7 @@ const htmlSAXHandler HTMLParser::saxHandler = {
 	StartElement,
 	EndElement,
 	NULL,
-	NULL, // was: Characters but that is an empty function
+	Characters,
 	NULL,
 	NULL,
 	NULL,
@@ -88,7 +343,7 @@ const htmlSAXHandler HTMLParser::saxHandler = {
 	NULL,
 	NULL,
 	NULL,
-	NULL, // was: cdata but that is an empty function
+	Characters, // <style> contents are reported as CDATA
 	NULL,
 	0,
 	NULL,
@@ -100,7 +355,7 @@ const htmlSAXHandler HTMLParser::saxHandler = {
 //
 //  Parse given (assumed to be) HTML text and return the title
 //
-void HTMLParser::parseHtml(const string& htmlPath, const string& global_url_, set<string>& url_list) {
+void HTMLParser::parseHtml(const string& htmlPath, const string& global_url_, set<string>& url_list, long min_width, set<string>* link_list, set<string>* css_list) {
 	htmlParserCtxtPtr ctxt;
 	Context ctx;
 	int parserErrors;
@@ -111,6 +366,14 @@ void HTMLParser::parseHtml(const string& htmlPath, const string& global_url_, se
 
 	ctx.global_base_prefix = global_url_;
 	ctx.url_list = &url_list;
+	ctx.min_width = min_width;
+	ctx.in_picture = false;
+	ctx.link_list = link_list;
+	ctx.host = hostOf(global_url_);
+	ctx.css_list = css_list;
+	ctx.in_style = false;
+	if (ctx.host.empty())
+		ctx.link_list = NULL;
 
 	if (!(buf = new char[bufSize])) {
 		Logger::error("new");
@@ -139,6 +402,8 @@ void HTMLParser::parseHtml(const string& htmlPath, const string& global_url_, se
 	}
 	htmlFreeParserCtxt(ctxt);
 	url_list.erase(global_url_);
+	if (link_list)
+		link_list->erase(global_url_);
 	fclose(fp);
 	delete[] buf;
 }
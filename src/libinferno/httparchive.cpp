@@ -0,0 +1,249 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+#include <strings.h>
+
+#include "httparchive.h"
+#include "mynetlib.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+string ReplayServer::dir;
+long ReplayServer::port = 0;
+bool ReplayServer::started = false;
+pthread_mutex_t ReplayServer::lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Archive key of a URL (64-bit FNV-1a hash, in hex).
+ */
+string HttpArchive::key(const string& url) {
+	unsigned long long h = 14695981039346656037ULL;
+	char buf[17];
+
+	for (size_t i = 0; i < url.size(); i++) {
+		h ^= (unsigned char)url[i];
+		h *= 1099511628211ULL;
+	}
+	snprintf(buf, sizeof(buf), "%016llx", h);
+	return buf;
+}
+
+/**
+ * Stores a response as <dir>/<key>: a text header (URL, status, timing and
+ * response headers) followed by an empty line and the body.
+ */
+int HttpArchive::store(const string& dir, const Record& rec) {
+	string path = dir + "/" + key(rec.url);
+	string tmp = path + ".tmp";
+	ofstream out(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+
+	if (!out) {
+		Logger::error("Unable to open archive file %s", tmp.c_str());
+		return -1;
+	}
+
+	out << "URL " << rec.url << "\n"
+		<< "STATUS " << rec.status << "\n"
+		<< "TTFB " << rec.ttfb << "\n"
+		<< "TOTAL " << rec.total << "\n";
+	for (vector<string>::const_iterator it = rec.headers.begin(); it != rec.headers.end(); it++)
+		out << "HEADER " << *it << "\n";
+	out << "\n";
+	out.write(rec.body.data(), rec.body.size());
+	out.close();
+
+	if (out.fail() || rename(tmp.c_str(), path.c_str())) {
+		Logger::error("Unable to store archive file %s", path.c_str());
+		unlink(tmp.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+int HttpArchive::load(const string& dir, const string& key, Record& rec) {
+	string path = dir + "/" + key;
+	ifstream in(path.c_str(), ios::in | ios::binary);
+	string line;
+
+	if (!in)
+		return -1;
+
+	rec = Record();
+	while (getline(in, line) && !line.empty()) {
+		string field, value;
+		size_t sp = line.find(' ');
+
+		field = line.substr(0, sp);
+		value = (sp == string::npos) ? "" : line.substr(sp + 1);
+		if (field == "URL")
+			rec.url = value;
+		else if (field == "STATUS")
+			rec.status = atol(value.c_str());
+		else if (field == "TTFB")
+			rec.ttfb = atof(value.c_str());
+		else if (field == "TOTAL")
+			rec.total = atof(value.c_str());
+		else if (field == "HEADER")
+			rec.headers.push_back(value);
+	}
+
+	stringstream body;
+	body << in.rdbuf();
+	rec.body = body.str();
+	return (rec.status ? 0 : -1);
+}
+
+/**
+ * Starts the replay server on the loopback interface, once per process.
+ * Returns 0 on success, -1 on failure.
+ */
+int ReplayServer::start(const string& dir, long port) {
+	int ret = 0;
+
+	pthread_mutex_lock(&lock);
+	if (!started) {
+		char serv[16];
+		ServerEndpoint *srv;
+		pthread_t tid;
+
+		snprintf(serv, sizeof(serv), "%ld", port);
+		srv = new ServerEndpoint("127.0.0.1", serv, 64);
+		if (srv->init() || pthread_create(&tid, NULL, acceptLoop, srv)) {
+			Logger::error("Unable to start replay server on port %ld", port);
+			delete srv;
+			ret = -1;
+		} else {
+			// clients may hang up before a response is through
+			signal(SIGPIPE, SIG_IGN);
+			pthread_detach(tid);
+			ReplayServer::dir = dir;
+			ReplayServer::port = port;
+			started = true;
+			Logger::info("Replaying responses from %s on port %ld", dir.c_str(), port);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+/**
+ * Returns the URL the replayed response of url is served at.
+ */
+string ReplayServer::rewrite(const string& url) {
+	stringstream ss;
+
+	ss << "http://127.0.0.1:" << port << "/" << HttpArchive::key(url);
+	return ss.str();
+}
+
+void* ReplayServer::acceptLoop(void *arg) {
+	ServerEndpoint *srv = (ServerEndpoint *)arg;
+
+	while (true) {
+		ClientEndpoint *client = NULL;
+		pthread_t tid;
+
+		if (srv->getNextClientFromEndpoint(client))
+			continue;
+		if (pthread_create(&tid, NULL, serve, client)) {
+			Logger::error("pthread_create");
+			delete client;
+			continue;
+		}
+		pthread_detach(tid);
+	}
+	return NULL;
+}
+
+void* ReplayServer::serve(void *arg) {
+	ClientEndpoint *client = (ClientEndpoint *)arg;
+	HttpArchive::Record rec;
+	string request, reply;
+	char buf[4096];
+	int n;
+
+	// read the request head
+	while (request.find("\r\n\r\n") == string::npos && request.size() < 65536) {
+		if ((n = client->recvDataFromEndpoint(buf, sizeof(buf))) <= 0)
+			break;
+		request.append(buf, n);
+	}
+
+	string method, target;
+	stringstream rs(request);
+	rs >> method >> target;
+
+	if (target.size() < 2 || HttpArchive::load(dir, target.substr(1), rec)) {
+		Logger::warn("Replay: no archived response for %s", target.c_str());
+		reply = "HTTP/1.1 502 Not In Archive\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		client->sendDataToEndpoint(reply.data(), reply.size());
+		delete client;
+		return NULL;
+	}
+
+	stringstream head;
+	head << "HTTP/1.1 " << rec.status << " Replayed\r\n";
+	for (vector<string>::iterator it = rec.headers.begin(); it != rec.headers.end(); it++) {
+		// framing is ours; bodies are archived decoded
+		if (!strncasecmp(it->c_str(), "HTTP/", 5) ||
+				!strncasecmp(it->c_str(), "Content-Length:", 15) ||
+				!strncasecmp(it->c_str(), "Content-Encoding:", 17) ||
+				!strncasecmp(it->c_str(), "Transfer-Encoding:", 18) ||
+				!strncasecmp(it->c_str(), "Connection:", 11))
+			continue;
+		head << *it << "\r\n";
+	}
+	head << "Content-Length: " << rec.body.size() << "\r\nConnection: close\r\n\r\n";
+	reply = head.str();
+
+	// reproduce the recorded latency and transfer time
+	usleep((useconds_t)(rec.ttfb * 1000000));
+	if (client->sendDataToEndpoint(reply.data(), reply.size()) < 0) {
+		delete client;
+		return NULL;
+	}
+
+	static const size_t chunks = 16;
+	size_t chunk = rec.body.size() / chunks + 1;
+	double pause = (rec.total > rec.ttfb) ? (rec.total - rec.ttfb) / chunks : 0;
+	for (size_t off = 0; off < rec.body.size(); off += chunk) {
+		if (pause > 0)
+			usleep((useconds_t)(pause * 1000000));
+		if (client->sendDataToEndpoint(rec.body.data() + off, min(chunk, rec.body.size() - off)) < 0)
+			break;
+	}
+
+	delete client;
+	return NULL;
+}
@@ -32,6 +32,8 @@ const string InfernoConf::CACHE_TABLE        = "cache";
 const string InfernoConf::CACHE_UNAME        = "usr_inferno";
 const string InfernoConf::CACHE_PASSWD       = "<passwd>";
 const string InfernoConf::CACHE_DIR          = "/tmp/inferno";
+const string InfernoConf::LOCAL_STORE        = "/var/cache/inferno/verdicts";
+const long InfernoConf::LOCAL_SLOTS     = 4194304L;
 const long InfernoConf::REDIR_LIMIT     = 10L;
 const long InfernoConf::CONNECT_TIMEOUT = 10L;
 const long InfernoConf::MAX_CONC_XFERS  = 40L;
@@ -39,6 +41,27 @@ const long InfernoConf::POLL_INTERVAL   = 200000L;
 const long InfernoConf::LOW_SPEED_LIMIT = 100L;
 const long InfernoConf::LOW_SPEED_TIME  = 5L;
 const long InfernoConf::ACC_THRESH	   = 40;
+const long InfernoConf::FAIL_BACKOFF    = 60L;
+const long InfernoConf::FAIL_BACKOFF_MAX = 86400L;
+const long InfernoConf::DNS_CACHE_TTL   = 60L;
+const long InfernoConf::HEDGE_PERCENTILE = 95L;
+const long InfernoConf::HEDGE_RATIO     = 5L;
+const long InfernoConf::MIN_IMAGE_WIDTH  = 200L;
+const long InfernoConf::PARTIAL_SCANS    = 0L;
+const long InfernoConf::PARTIAL_CONFIDENCE = 90L;
+const long InfernoConf::PREFETCH_LINKS   = 0L;
+const long InfernoConf::PREFETCH_RATE    = 10L;
+const long InfernoConf::CSS_CACHE_TTL    = 600L;
+const long InfernoConf::REPLAY_PORT      = 1346L;
+const long InfernoConf::SPOOL_HIGH = 0L;
+const long InfernoConf::SPOOL_LOW = 0L;
+const long InfernoConf::SPOOL_MAX_AGE = 0L;
+const long InfernoConf::SPOOL_LEVELS = 1L;
+const long InfernoConf::SPOOL_DIGITS = 1L;
+const long InfernoConf::MAX_SPOOL_LEVELS = 4L;
+const long InfernoConf::MAX_SPOOL_DIGITS = 3L;
+const long InfernoConf::CACHE_RETENTION = 0L;
+const long InfernoConf::REAP_RATE = 0L;
 const InfernoConf::FilteringMode InfernoConf::FILTERING_MODE  = InfernoConf::F_MODE_PAGE;
 
 const char* InfernoConf::img_ext[] = {
@@ -83,15 +106,41 @@ const char* InfernoConf::img_mimes[] = {
 };
 
 
+/**
+ * Returns the spool path of the given hash, under one directory per level
+ * of the configured fan-out, each named after the next digits of the hash,
+ * or an empty path if the hash is too short to be one.
+ */
 string InfernoConf::computePathFromHash(const string& hash) const {
+	string path = cache_dir;
+
+	if (hash.length() <= (size_t)(spool_levels * spool_digits))
+		return "";
+
+	for (long i = 0; i < spool_levels; i++) {
+		path.push_back('/');
+		path.append(hash, i * spool_digits, spool_digits);
+	}
+	path.push_back('/');
+	return path.append(hash);
+}
+
+/**
+ * Returns the spool path of the given hash in the default layout, where
+ * files spooled before the fan-out was changed may still be found, or an
+ * empty path for an empty hash.
+ */
+string InfernoConf::computeLegacyPathFromHash(const string& hash) const {
+	if (hash.empty())
+		return "";
 	return cache_dir + "/" + hash.substr(0, 1) + "/" + hash;
 }
 
 string InfernoConf::toString() const {
 	stringstream ss;
 
-	ss << redir_limit << " " << conn_timeo << " " << max_xfers << " " << poll_interval << " " << low_speed_lim << " " << low_speed_time << " " << acc_thresh << " " << f_mode << "\n" <<
-		cache_host << "\n" << cache_store << "\n" << cache_table << "\n" << cache_uname << "\n" << cache_passwd << "\n" << cache_dir << "\n";
+	ss << redir_limit << " " << conn_timeo << " " << max_xfers << " " << poll_interval << " " << low_speed_lim << " " << low_speed_time << " " << acc_thresh << " " << f_mode << " " << fail_backoff << " " << fail_backoff_max << " " << dns_ttl << " " << hedge_pct << " " << hedge_ratio << " " << min_width << " " << partial_scans << " " << partial_conf << " " << cache_backend << " " << local_slots << " " << spool_levels << " " << spool_digits << " " << cache_retention << " " << reap_rate << "\n" <<
+		cache_host << "\n" << cache_store << "\n" << cache_table << "\n" << cache_uname << "\n" << cache_passwd << "\n" << cache_dir << "\n" << local_store << "\n";
 	return ss.str();
 }
 
@@ -104,6 +153,7 @@ InfernoConf* InfernoConf::parseString(const string& str) {
 	string cache_uname;
 	string cache_passwd;
 	string cache_dir;
+	string local_store;
 	long redir_limit;
 	long conn_timeo;
 	long max_xfers;
@@ -112,9 +162,23 @@ InfernoConf* InfernoConf::parseString(const string& str) {
 	long low_speed_time;
 	long acc_thresh;
 	long f_mode_int;
+	long fail_backoff;
+	long fail_backoff_max;
+	long dns_ttl;
+	long hedge_pct;
+	long hedge_ratio;
+	long min_width;
+	long partial_scans;
+	long partial_conf;
+	long cache_backend;
+	long local_slots;
+	long spool_levels;
+	long spool_digits;
+	long cache_retention;
+	long reap_rate;
 	FilteringMode f_mode;
 
-	ss >> redir_limit >> conn_timeo  >> max_xfers >> poll_interval >> low_speed_lim >> low_speed_time >> acc_thresh >> f_mode_int;
+	ss >> redir_limit >> conn_timeo  >> max_xfers >> poll_interval >> low_speed_lim >> low_speed_time >> acc_thresh >> f_mode_int >> fail_backoff >> fail_backoff_max >> dns_ttl >> hedge_pct >> hedge_ratio >> min_width >> partial_scans >> partial_conf >> cache_backend >> local_slots >> spool_levels >> spool_digits >> cache_retention >> reap_rate;
 	switch (f_mode_int) {
 		case F_MODE_PAGE:
 		case F_MODE_IMAGE:
@@ -131,9 +195,40 @@ InfernoConf* InfernoConf::parseString(const string& str) {
 	getline(ss, cache_uname);
 	getline(ss, cache_passwd);
 	getline(ss, cache_dir);
-	if (ss.fail())
+	getline(ss, local_store);
+	if (ss.fail() || (cache_backend != BACKEND_MYSQL && cache_backend != BACKEND_LOCAL))
 		return NULL;
-	ret = new InfernoConf(cache_host, cache_store, cache_table, cache_uname, cache_passwd, cache_dir, redir_limit, conn_timeo, max_xfers, poll_interval, low_speed_lim, low_speed_time, acc_thresh, f_mode);
+
+	ret = new InfernoConf();
+	ret->setHostname(cache_host);
+	ret->setStore(cache_store);
+	ret->setTable(cache_table);
+	ret->setUsername(cache_uname);
+	ret->setPassword(cache_passwd);
+	ret->setDirectory(cache_dir);
+	ret->setCacheBackend((CacheBackend)cache_backend);
+	ret->setLocalStore(local_store);
+	ret->setLocalSlots(local_slots);
+	ret->setRedirLimit(redir_limit);
+	ret->setConnTimeout(conn_timeo);
+	ret->setMaxXfers(max_xfers);
+	ret->setPollInterval(poll_interval);
+	ret->setLowSpeedLimit(low_speed_lim);
+	ret->setLowSpeedTime(low_speed_time);
+	ret->setAcceptanceThreshold(acc_thresh);
+	ret->setFilteringMode(f_mode);
+	ret->setFailureBackoff(fail_backoff);
+	ret->setFailureBackoffMax(fail_backoff_max);
+	ret->setDnsCacheTTL(dns_ttl);
+	ret->setHedgePercentile(hedge_pct);
+	ret->setHedgeRatio(hedge_ratio);
+	ret->setMinImageWidth(min_width);
+	ret->setPartialScans(partial_scans);
+	ret->setPartialConfidence(partial_conf);
+	ret->setSpoolLevels(spool_levels);
+	ret->setSpoolDigits(spool_digits);
+	ret->setCacheRetention(cache_retention);
+	ret->setReapRate(reap_rate);
 	return ret;
 }
 
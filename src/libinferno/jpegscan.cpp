@@ -0,0 +1,169 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "jpegscan.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+JpegScanner::JpegScanner() :
+	state(J_SOI1), after_skip(J_SEEK), marker(0), skip(0), offset(0),
+	ff_offset(0), progressive(false), scans(0), scan_end(0) {}
+
+void JpegScanner::onMarker(int m) {
+	marker = m;
+	if ((m >= 0xD0 && m <= 0xD7) || m == 0x01) {
+		// standalone markers
+		state = J_SEEK;
+	} else if (m == 0xD9) {
+		// EOI
+		state = J_DONE;
+	} else
+		state = J_LEN1;
+}
+
+/**
+ * Scans the next len bytes of the image. Segment payloads are skipped
+ * rather than searched for markers, as they may embed whole JPEG images
+ * (e.g. EXIF thumbnails).
+ */
+void JpegScanner::feed(const char *buf, size_t len) {
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t i = 0;
+
+	while (i < len && state != J_DONE) {
+		unsigned char b = p[i];
+
+		switch (state) {
+			case J_SOI1:
+				state = (b == 0xFF) ? J_SOI2 : J_DONE;
+				break;
+			case J_SOI2:
+				state = (b == 0xD8) ? J_SEEK : J_DONE;
+				break;
+			case J_SEEK:
+				state = (b == 0xFF) ? J_MARKER : J_DONE;
+				break;
+			case J_MARKER:
+				if (b != 0xFF) // fill bytes
+					onMarker(b);
+				break;
+			case J_LEN1:
+				skip = b << 8;
+				state = J_LEN2;
+				break;
+			case J_LEN2:
+				skip |= b;
+				if (skip < 2) {
+					state = J_DONE;
+					break;
+				}
+				skip -= 2;
+				if (marker == 0xC2)
+					progressive = true;
+				after_skip = (marker == 0xDA) ? J_ENTROPY : J_SEEK;
+				state = skip ? J_SKIP : after_skip;
+				break;
+			case J_SKIP: {
+				size_t n = len - i;
+				if (n > skip)
+					n = skip;
+				skip -= n;
+				i += n;
+				offset += n;
+				if (!skip)
+					state = after_skip;
+				continue;
+			}
+			case J_ENTROPY:
+				if (b == 0xFF) {
+					ff_offset = offset;
+					state = J_ENTROPY_FF;
+				}
+				break;
+			case J_ENTROPY_FF:
+				if (b == 0x00 || (b >= 0xD0 && b <= 0xD7))
+					state = J_ENTROPY; // stuffed byte or restart marker
+				else if (b != 0xFF) {
+					// any other marker ends the scan
+					scans++;
+					scan_end = ff_offset;
+					onMarker(b);
+				}
+				break;
+			case J_DONE:
+			default:
+				break;
+		}
+		i++;
+		offset++;
+	}
+}
+
+/**
+ * Copies the first scans of the progressive JPEG in file descriptor src to
+ * dst, terminated so that decoders take it for a complete image. Returns
+ * false if src is not a progressive JPEG or has fewer scans; used and total
+ * are set to the number of bytes copied and read, respectively.
+ */
+bool JpegScanner::truncate(int src, const string& dst, int scans, size_t& used, size_t& total) {
+	JpegScanner scanner;
+	FILE *out;
+	string data;
+	char buf[4096];
+	ssize_t nread;
+	static const char eoi[] = {(char)0xFF, (char)0xD9};
+
+	used = total = 0;
+	// read from the start, leaving the file offset of src alone
+	while (scanner.getScans() < scans && !scanner.isDone() && (nread = pread(src, buf, sizeof(buf), data.size())) > 0) {
+		scanner.feed(buf, nread);
+		data.append(buf, nread);
+	}
+	total = data.size();
+
+	if (!scanner.isProgressive() || scanner.getScans() < scans)
+		return false;
+
+	if (!(out = fopen(dst.c_str(), "wb"))) {
+		Logger::error("fopen");
+		return false;
+	}
+	used = scanner.getScanEnd();
+	if (fwrite(data.data(), 1, used, out) != used || fwrite(eoi, 1, sizeof(eoi), out) != sizeof(eoi)) {
+		Logger::error("fwrite");
+		fclose(out);
+		unlink(dst.c_str());
+		return false;
+	}
+	if (fclose(out)) {
+		Logger::error("fclose");
+		unlink(dst.c_str());
+		return false;
+	}
+	return true;
+}
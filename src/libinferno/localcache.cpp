@@ -0,0 +1,595 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "localcache.h"
+#include "spoolmanager.h"
+#include "verdictbus.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+#define LOCAL_MAGIC "INFLOC1"
+#define HEADER_SIZE 4096
+
+enum SlotState { SLOT_EMPTY, SLOT_USED, SLOT_DELETED };
+
+/** Fixed part of the store file, followed by the slots */
+struct LocalStoreHeader {
+	char magic[8];
+	uint32_t slot_size;
+	uint64_t slots;
+	uint64_t used;
+	uint64_t deleted;
+	pthread_mutex_t lock;
+	/* next slots to be examined by the reaper (zero in stores created
+	 * before these were added, which is where it starts anyway) */
+	uint64_t expire_cursor;
+	uint64_t stale_cursor;
+};
+
+struct LocalSlot {
+	unsigned char key[16];
+	uint8_t state;
+	uint8_t status;
+	uint8_t decision;
+	uint8_t ctype_len;
+	uint32_t failures;
+	uint32_t modified;
+	uint32_t retry_after;
+	char ctype[48];
+};
+
+const int LocalCache::MAX_LOAD = 60;
+const int LocalCache::COMPACT_LOAD = 70;
+const uint64_t LocalCache::SCAN_SLOTS = 65536;
+
+LocalCache::LocalCache() {
+	header = NULL;
+	slots = NULL;
+	map_size = 0;
+	error = 0;
+}
+
+LocalCache::~LocalCache() {
+	cleanup();
+}
+
+/**
+ * Maps the store file, creating and initializing it if it does not exist.
+ * Processes opening the store at the same time are serialized with flock(),
+ * so that it is initialized exactly once.
+ *
+ * Returns: 1 for success, 0 otherwise
+ */
+int LocalCache::connect() {
+	string path = dbConf.getLocalStore();
+	string dir = path.substr(0, path.rfind('/'));
+	long configured = dbConf.getLocalSlots();
+	uint64_t nslots = (configured > 0) ? (uint64_t)configured * 100 / MAX_LOAD + 1 : 0;
+	LocalStoreHeader existing;
+	bool fresh;
+	struct stat st;
+	void *map;
+	int fd;
+
+	cleanup();
+
+	if (!dir.empty() && SpoolManager::checkAndCreateDir(dir.c_str()))
+		return 0;
+
+	if ((fd = open(path.c_str(), O_RDWR | O_CREAT, 0660)) < 0 || flock(fd, LOCK_EX)) {
+		error = errno;
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	if (fstat(fd, &st)) {
+		error = errno;
+		close(fd);
+		return 0;
+	}
+
+	// a store whose creator died before finishing it has no magic yet
+	memset(&existing, 0, sizeof(existing));
+	if (st.st_size > 0 && pread(fd, &existing, sizeof(existing), 0) < 0) {
+		error = errno;
+		close(fd);
+		return 0;
+	}
+	fresh = !existing.magic[0];
+
+	if (!fresh) {
+		// sized by whoever created it
+		if (memcmp(existing.magic, LOCAL_MAGIC, sizeof(existing.magic)) ||
+				existing.slot_size != sizeof(LocalSlot)) {
+			Logger::error("%s is not a verdict store", path.c_str());
+			error = EINVAL;
+			close(fd);
+			return 0;
+		}
+		if (existing.slots != nslots)
+			Logger::info("Verdict store %s has %llu slots; ignoring configured size", path.c_str(), (unsigned long long)existing.slots);
+		nslots = existing.slots;
+	} else if (!nslots || ftruncate(fd, 0) || ftruncate(fd, HEADER_SIZE + nslots * sizeof(LocalSlot))) {
+		error = nslots ? errno : EINVAL;
+		close(fd);
+		return 0;
+	}
+
+	map_size = HEADER_SIZE + nslots * sizeof(LocalSlot);
+	if ((map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		error = errno;
+		close(fd);
+		return 0;
+	}
+	header = (LocalStoreHeader *)map;
+	slots = (LocalSlot *)((char *)map + HEADER_SIZE);
+
+	if (fresh) {
+		pthread_mutexattr_t attr;
+
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&header->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+
+		header->slot_size = sizeof(LocalSlot);
+		header->slots = nslots;
+		header->used = header->deleted = 0;
+		// the magic goes in last; the store is unusable until then
+		memcpy(header->magic, LOCAL_MAGIC, sizeof(header->magic));
+		msync(map, HEADER_SIZE, MS_SYNC);
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+	return 1;
+}
+
+int LocalCache::reconnect(int times) {
+	if (header)
+		return 1;
+
+	for (int i = 0; i < times; i++)
+		if (connect())
+			return 1;
+	return 0;
+}
+
+int LocalCache::getErrorCode() {
+	return error;
+}
+
+char* LocalCache::getErrorString() {
+	return strerror(error);
+}
+
+void LocalCache::cleanup() {
+	if (header)
+		munmap(header, map_size);
+	header = NULL;
+	slots = NULL;
+	map_size = 0;
+}
+
+/**
+ * Takes the store lock, recovering it if its previous holder died.
+ */
+int LocalCache::lock() {
+	int ret = pthread_mutex_lock(&header->lock);
+
+	if (ret == EOWNERDEAD) {
+		Logger::warn("Recovering verdict store lock from a dead process");
+		pthread_mutex_consistent(&header->lock);
+		ret = 0;
+	}
+	if (ret)
+		error = ret;
+	return ret;
+}
+
+void LocalCache::unlock() {
+	pthread_mutex_unlock(&header->lock);
+}
+
+/**
+ * Probes for the slot of the given key, linearly from its home slot. Hashes
+ * are MD5 digests, so their first bytes are as good a slot index as any.
+ *
+ * Returns: the slot of the key if present, or (when inserting) the slot to
+ * put it in, or NULL; to be called with the lock held
+ */
+LocalSlot* LocalCache::find(const unsigned char *key, bool insert) {
+	uint64_t home, n = header->slots;
+	LocalSlot *free_slot = NULL;
+
+	memcpy(&home, key, sizeof(home));
+	home %= n;
+
+	for (uint64_t i = 0; i < n; i++) {
+		LocalSlot *slot = &slots[(home + i) % n];
+
+		if (slot->state == SLOT_EMPTY)
+			return insert ? (free_slot ? free_slot : slot) : NULL;
+		if (slot->state == SLOT_DELETED) {
+			if (!free_slot)
+				free_slot = slot;
+			continue;
+		}
+		if (!memcmp(slot->key, key, sizeof(slot->key)))
+			return slot;
+	}
+	return insert ? free_slot : NULL;
+}
+
+void LocalCache::erase(LocalSlot *slot) {
+	slot->state = SLOT_DELETED;
+	header->used--;
+	header->deleted++;
+}
+
+/**
+ * Re-inserts the live entries of a table clogged with deleted ones, so that
+ * probes stop at empty slots again. To be called with the lock held.
+ */
+void LocalCache::compact() {
+	vector<LocalSlot> live;
+
+	Logger::info("Compacting verdict store (%llu entries, %llu deleted)",
+			(unsigned long long)header->used, (unsigned long long)header->deleted);
+
+	for (uint64_t i = 0; i < header->slots; i++)
+		if (slots[i].state == SLOT_USED)
+			live.push_back(slots[i]);
+
+	memset(slots, 0, header->slots * sizeof(LocalSlot));
+	header->deleted = 0;
+	for (vector<LocalSlot>::iterator it = live.begin(); it != live.end(); it++)
+		*find(it->key, true) = *it;
+}
+
+/**
+ * Returns: the slot of an existing entry, or NULL; to be called with the
+ * lock held
+ */
+LocalSlot* LocalCache::slotOf(const string& hash) {
+	unsigned char key[HASH_BYTES];
+
+	if (!hashBytes(hash, key))
+		return NULL;
+	return find(key, false);
+}
+
+/**
+ * Returns: 1 for success, -1 if an entry exists already, 0 otherwise
+ */
+int LocalCache::insertUrlEntry(const string& url, string& hash) {
+	unsigned char key[HASH_BYTES];
+	uint32_t now = time(NULL);
+	LocalSlot *slot;
+	int ret = 0;
+
+	if (url.empty() || !reconnect())
+		return 0;
+
+	if ((hash = hashUrl(url)).empty() || !hashBytes(hash, key) || lock())
+		return 0;
+
+	if ((header->used + header->deleted) * 100 >= header->slots * COMPACT_LOAD)
+		compact();
+
+	if (!(slot = find(key, true))) {
+		error = ENOSPC;
+	} else if (slot->state == SLOT_USED) {
+		// re-claim failures whose back-off period has elapsed
+		if (slot->status == InfernoConf::STATUS_FAILURE && slot->retry_after <= now) {
+			Logger::debug("Back-off period for %s has elapsed. Re-fetching...", hash.c_str());
+			slot->status = InfernoConf::STATUS_FETCHING;
+			slot->decision = InfernoConf::CLASS_UNDEFINED;
+			slot->modified = now;
+			ret = 1;
+		} else {
+			ret = -1;
+		}
+	} else if ((header->used + 1) * 100 > header->slots * MAX_LOAD) {
+		Logger::error("Verdict store is full");
+		error = ENOSPC;
+	} else {
+		if (slot->state == SLOT_DELETED)
+			header->deleted--;
+		memset(slot, 0, sizeof(*slot));
+		memcpy(slot->key, key, sizeof(slot->key));
+		slot->state = SLOT_USED;
+		slot->status = InfernoConf::STATUS_FETCHING;
+		slot->decision = InfernoConf::CLASS_UNDEFINED;
+		slot->modified = now;
+		header->used++;
+		ret = 1;
+	}
+
+	unlock();
+	return ret;
+}
+
+int LocalCache::updateUrlStatus(const string& hash, InfernoConf::Status status) {
+	LocalSlot *slot;
+
+	if (status == InfernoConf::STATUS_FAILURE)
+		return updateUrlFailure(hash, "unspecified failure");
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash))) {
+		slot->status = status;
+		if (status == InfernoConf::STATUS_DONE)
+			slot->failures = 0;
+		slot->modified = time(NULL);
+	}
+
+	unlock();
+	if (slot && status == InfernoConf::STATUS_DONE)
+		VerdictBus::publish(dbConf, hash);
+	return slot != NULL;
+}
+
+int LocalCache::updateUrlClassification(const string& hash, InfernoConf::Classification classification) {
+	LocalSlot *slot;
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash))) {
+		slot->decision = classification;
+		slot->modified = time(NULL);
+	}
+
+	unlock();
+	return slot != NULL;
+}
+
+int LocalCache::updateUrlContentType(const string& hash, const string& ctype) {
+	LocalSlot *slot;
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash))) {
+		slot->ctype_len = (ctype.length() < sizeof(slot->ctype)) ? ctype.length() : sizeof(slot->ctype);
+		memcpy(slot->ctype, ctype.data(), slot->ctype_len);
+		slot->modified = time(NULL);
+	}
+
+	unlock();
+	return slot != NULL;
+}
+
+/**
+ * Marks an entry as failed and schedules the next attempt, with the same
+ * back-off policy as the MySQL backend. The reason is only logged.
+ */
+int LocalCache::updateUrlFailure(const string& hash, const string& reason) {
+	uint32_t now = time(NULL);
+	LocalSlot *slot;
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash))) {
+		Logger::debug("Entry %s failed: %s", hash.c_str(), reason.c_str());
+		if (dbConf.getFailureBackoff() <= 0) {
+			erase(slot);
+		} else {
+			long backoff = dbConf.getFailureBackoff();
+
+			slot->status = InfernoConf::STATUS_FAILURE;
+			slot->failures++;
+			for (uint32_t i = 1; i < slot->failures && backoff < dbConf.getFailureBackoffMax(); i++)
+				backoff *= 2;
+			if (backoff > dbConf.getFailureBackoffMax())
+				backoff = dbConf.getFailureBackoffMax();
+			slot->retry_after = now + backoff;
+			slot->modified = now;
+		}
+	}
+
+	unlock();
+	if (slot)
+		VerdictBus::publish(dbConf, hash);
+	return slot != NULL;
+}
+
+/**
+ * Removes an entry whose fetch was abandoned before completion. Completed
+ * entries are kept.
+ *
+ * Returns: 1 if the entry was removed, 0 otherwise
+ */
+int LocalCache::removeUrlEntry(const string& hash) {
+	LocalSlot *slot;
+	int ret = 0;
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash)) && slot->status != InfernoConf::STATUS_DONE && slot->status != InfernoConf::STATUS_FAILURE) {
+		erase(slot);
+		ret = 1;
+	}
+
+	unlock();
+	if (ret)
+		VerdictBus::publish(dbConf, hash);
+	return ret;
+}
+
+/**
+ * Marks the verdict on an entry as changed now, so that it is kept for
+ * another retention period. Entries in progress are left alone.
+ *
+ * Returns: 1 if the verdict was renewed, 0 otherwise
+ */
+int LocalCache::renewUrlVerdict(const string& hash) {
+	LocalSlot *slot;
+	int ret = 0;
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash)) && slot->status == InfernoConf::STATUS_DONE) {
+		slot->modified = time(NULL);
+		ret = 1;
+	}
+
+	unlock();
+	return ret;
+}
+
+int LocalCache::lookupUrlRecord(const string& hash, UrlRecord& record) {
+	LocalSlot *slot;
+
+	record.status = InfernoConf::STATUS_ERROR;
+	record.decision = InfernoConf::CLASS_ERROR;
+	record.ctype.clear();
+	record.failures = 0;
+	record.modified = record.retry_after = 0;
+
+	if (!reconnect() || lock())
+		return 0;
+
+	if ((slot = slotOf(hash))) {
+		record.status = (InfernoConf::Status)slot->status;
+		record.decision = (InfernoConf::Classification)slot->decision;
+		record.ctype.assign(slot->ctype, slot->ctype_len);
+		record.failures = slot->failures;
+		record.modified = slot->modified;
+		record.retry_after = slot->retry_after;
+	}
+
+	unlock();
+	return slot != NULL;
+}
+
+/**
+ * Removes all entries not done or failed, left behind by processes that
+ * exited while working on them.
+ */
+int LocalCache::fixCache() {
+	if (!reconnect() || lock())
+		return 0;
+
+	for (uint64_t i = 0; i < header->slots; i++)
+		if (slots[i].state == SLOT_USED &&
+				slots[i].status != InfernoConf::STATUS_DONE &&
+				slots[i].status != InfernoConf::STATUS_FAILURE)
+			erase(&slots[i]);
+
+	unlock();
+	return 1;
+}
+
+/**
+ * Removes done or failed entries last changed more than 'age' seconds ago,
+ * up to 'limit' of them, going on from the slot where the previous call
+ * (of any process) stopped. At most SCAN_SLOTS slots are examined per
+ * call; 'more' tells whether the pass over the table is to be continued.
+ *
+ * Returns: the number of entries removed, or -1 on error
+ */
+int LocalCache::expireUrlEntries(long age, size_t limit, bool& more) {
+	uint32_t before = time(NULL) - age;
+	int ret = 0;
+
+	more = false;
+	if (!reconnect() || lock())
+		return -1;
+
+	if (header->expire_cursor >= header->slots)
+		header->expire_cursor = 0;
+
+	more = true;
+	for (uint64_t i = 0; i < SCAN_SLOTS && (size_t)ret < limit; i++) {
+		LocalSlot *slot = &slots[header->expire_cursor];
+
+		if (slot->state == SLOT_USED && slot->modified < before &&
+				(slot->status == InfernoConf::STATUS_DONE || slot->status == InfernoConf::STATUS_FAILURE)) {
+			erase(slot);
+			ret++;
+		}
+		if (++header->expire_cursor == header->slots) {
+			header->expire_cursor = 0;
+			more = false;
+			break;
+		}
+	}
+
+	unlock();
+	return ret;
+}
+
+/**
+ * Lists entries in progress last changed more than 'age' seconds ago, up
+ * to 'limit' of them, going on from the slot where the previous call (of
+ * any process) stopped, and examining at most SCAN_SLOTS slots.
+ *
+ * Returns: the number of entries listed, or -1 on error
+ */
+int LocalCache::staleUrlEntries(long age, size_t limit, vector<string>& hashes) {
+	uint32_t before = time(NULL) - age;
+
+	hashes.clear();
+	if (!reconnect() || lock())
+		return -1;
+
+	for (uint64_t i = 0; i < SCAN_SLOTS && i < header->slots && hashes.size() < limit; i++) {
+		LocalSlot *slot = &slots[header->stale_cursor++ % header->slots];
+		char hex[2 * HASH_BYTES + 1];
+
+		if (slot->state != SLOT_USED || slot->modified >= before ||
+				slot->status == InfernoConf::STATUS_DONE || slot->status == InfernoConf::STATUS_FAILURE)
+			continue;
+		for (int j = 0; j < HASH_BYTES; j++)
+			sprintf(hex + 2 * j, "%02x", slot->key[j]);
+		hashes.push_back(hex);
+	}
+	header->stale_cursor %= header->slots;
+
+	unlock();
+	return (int)hashes.size();
+}
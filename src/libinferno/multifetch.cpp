@@ -20,19 +20,63 @@
  */
 
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <map>
+#include <vector>
+
+#include <unistd.h>
 
 #include "seadclient.h"
+#include "cssparse.h"
+#include "dnscache.h"
+#include "fetchstats.h"
+#include "httparchive.h"
+#include "jpegscan.h"
+#include "prefetcher.h"
+#include "spoolwriter.h"
+#include "verdictbus.h"
 #include "multifetch.h"
 #include "htmlparse.h"
 #include "dbcache.h"
+#include "dbpool.h"
 #include "logger.h"
 #include "config.h"
 
 using namespace std;
 
-int Multifetch::consult_nimage_classifier(std::string hash, std::string type, SeadClient* sclient) {
+// Per-attempt state of an image transfer
+struct Multifetch::Transfer {
+	CURL *handle;
+	SpoolWriter *spool;
+	string url;
+	string hash;
+	string path;      // spool file the object ends up in
+	double started;
+	bool hedge;       // speculative second attempt for a slow transfer
+	Transfer *twin;   // the concurrent attempt for the same object, if any
+	bool slot;        // holds a slot of the transfer window
+	FetchStats::Outcome outcome;
+	double latency;
+	JpegScanner *scanner; // progressive scans received, for early classification
+	bool partial;     // early classification was attempted
+	bool partial_sent;
+	double partial_check; // last check for an early verdict
+};
+
+// State attached to an easy handle (through CURLOPT_PRIVATE)
+struct HandleState {
+	struct curl_slist *headers;
+	struct curl_slist *resolve;
+	SpoolWriter *spool;
+	std::string *buffer; // for objects kept in memory rather than spooled
+	JpegScanner *scanner;
+	HttpArchive::Record *record; // response being recorded, if any
+	std::string archive_dir;
+};
+
+int Multifetch::consult_nimage_classifier(std::string hash, std::string type, SeadClient* sclient, bool partial) {
 	std::string path;
 	SeadClient *sc = sclient;
 	int ret;
@@ -46,7 +90,7 @@ int Multifetch::consult_nimage_classifier(std::string hash, std::string type, Se
 	}
 
 	// send classification request per uri
-	ret = sc->classifyUri(hash, type, iConf);
+	ret = sc->classifyUri(hash, type, iConf, partial);
 
 	// return server's result
 	if (!sclient)
@@ -54,52 +98,364 @@ int Multifetch::consult_nimage_classifier(std::string hash, std::string type, Se
 	return ret;
 }
 
-CURL* Multifetch::setupHandle(const string& url, const string& hash, FILE *& fp, char *errorBuffer) {
+CURL* Multifetch::setupHandle(const string& url, SpoolWriter *spool, char *errorBuffer, int rotate, JpegScanner *scanner, string *buffer) {
 	// add new curl_easy
 	CURL *handle;
-	string path = iConf.computePathFromHash(hash);
 
-	if (path.empty() || url.empty() || hash.empty())
+	if ((!spool && !buffer) || url.empty())
 		return NULL;
 
-	if (!(fp = fopen(path.c_str(), "wb"))) {
-		perror("fopen");
+	if (spool && spool->open())
 		return NULL;
-	}
-	setbuf(fp, NULL);
 
 	if (!(handle = curl_easy_init())) {
 		perror("curl_easy_init");
+		if (spool)
+			spool->discard();
 		return NULL;
 	}
 
-	struct curl_slist* headers = NULL;
-	headers = curl_slist_append(headers,"Accept-Encoding: gzip, deflate");
-	headers = curl_slist_append(headers,"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/534.30 (KHTML, like Gecko) Chrome/12.0.742.112 Safari/534.30");
+	// option lists must outlive the transfer; they are released in cleanupHandle()
+	HandleState *lists = new HandleState;
+	lists->spool = spool;
+	lists->buffer = buffer;
+	lists->scanner = scanner;
+	lists->record = NULL;
+	lists->headers = NULL;
+	lists->headers = curl_slist_append(lists->headers,"Accept-Encoding: gzip, deflate");
+	lists->headers = curl_slist_append(lists->headers,"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/534.30 (KHTML, like Gecko) Chrome/12.0.742.112 Safari/534.30");
+	lists->resolve = NULL;
+
+	// when replaying, the archive stands in for the origin
+	string target = url;
+	if (iConf.getArchiveMode() == InfernoConf::ARCHIVE_REPLAY) {
+		if (ReplayServer::start(iConf.getArchiveDir(), iConf.getReplayPort())) {
+			curl_slist_free_all(lists->headers);
+			delete lists;
+			curl_easy_cleanup(handle);
+			if (spool)
+				spool->discard();
+			return NULL;
+		}
+		target = ReplayServer::rewrite(url);
+	} else
+		lists->resolve = DnsCache::resolveList(url, NULL, rotate);
+
+	if (iConf.getArchiveMode() == InfernoConf::ARCHIVE_RECORD) {
+		lists->record = new HttpArchive::Record;
+		lists->record->url = url;
+		lists->archive_dir = iConf.getArchiveDir();
+	}
 
 	if (errorBuffer && curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, errorBuffer) != CURLE_OK)
 		Logger::debug("Failed to set error buffer");
 
 	// set the options (I left out a few, you'll get the point anyway)
 	if (curl_easy_setopt(handle, CURLOPT_NOSIGNAL, (long)1) != CURLE_OK ||
-			curl_easy_setopt(handle, CURLOPT_URL, url.c_str()) != CURLE_OK ||
-			curl_easy_setopt(handle, CURLOPT_WRITEDATA, fp) != CURLE_OK ||
-			curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, NULL) != CURLE_OK ||
+			curl_easy_setopt(handle, CURLOPT_URL, target.c_str()) != CURLE_OK ||
+			curl_easy_setopt(handle, CURLOPT_WRITEDATA, handle) != CURLE_OK ||
+			curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeSpool) != CURLE_OK ||
 			curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, true) != CURLE_OK ||
 			(iConf.getRedirLimit() && curl_easy_setopt(handle, CURLOPT_MAXREDIRS, iConf.getRedirLimit()) != CURLE_OK) ||
 			(iConf.getConnTimeout() && curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, iConf.getConnTimeout()) != CURLE_OK) ||
 			(iConf.getLowSpeedLimit() && curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, iConf.getLowSpeedLimit()) != CURLE_OK) || 
 			(iConf.getLowSpeedTime() && curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, iConf.getLowSpeedTime()) != CURLE_OK) ||
 			curl_easy_setopt(handle, CURLOPT_ENCODING, "") != CURLE_OK ||
-			curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers) != CURLE_OK) {
+			curl_easy_setopt(handle, CURLOPT_HTTPHEADER, lists->headers) != CURLE_OK ||
+			curl_easy_setopt(handle, CURLOPT_PRIVATE, lists) != CURLE_OK ||
+			(lists->record && (curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, writeHeader) != CURLE_OK ||
+				curl_easy_setopt(handle, CURLOPT_HEADERDATA, lists->record) != CURLE_OK)) ||
+			(!lists->resolve && iConf.getArchiveMode() == InfernoConf::ARCHIVE_REPLAY &&
+				curl_easy_setopt(handle, CURLOPT_PROXY, "") != CURLE_OK) ||
+			(lists->resolve && curl_easy_setopt(handle, CURLOPT_RESOLVE, lists->resolve) != CURLE_OK) ||
+			(iConf.getDnsCacheTTL() && curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, iConf.getDnsCacheTTL()) != CURLE_OK)) {
 		Logger::debug("Failed setting options: %s", errorBuffer);
+		curl_slist_free_all(lists->headers);
+		curl_slist_free_all(lists->resolve);
+		delete lists->record;
+		delete lists;
 		curl_easy_cleanup(handle);
+		if (spool)
+			spool->discard();
 		return NULL;
 	}
 
+#if defined(CURL_HTTP_VERSION_2TLS) && defined(CURLPIPE_MULTIPLEX)
+	// negotiate HTTP/2 over TLS (ALPN) and wait for a connection to the same
+	// origin to become multiplexable rather than opening a new one
+	if (curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS) != CURLE_OK ||
+			curl_easy_setopt(handle, CURLOPT_PIPEWAIT, (long)1) != CURLE_OK)
+		Logger::debug("HTTP/2 not supported by libcurl. Falling back to HTTP/1.1");
+#endif
+
 	return handle;
 }
 
+void Multifetch::cleanupHandle(CURL *handle) {
+	HandleState *lists = NULL;
+
+	if (!handle)
+		return;
+
+	if (curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&lists) == CURLE_OK && lists) {
+		curl_slist_free_all(lists->headers);
+		curl_slist_free_all(lists->resolve);
+		delete lists->record;
+		delete lists;
+	}
+	curl_easy_cleanup(handle);
+}
+
+size_t Multifetch::writeHeader(char *ptr, size_t size, size_t nmemb, void *userdata) {
+	HttpArchive::Record *record = (HttpArchive::Record *)userdata;
+	string line(ptr, size * nmemb);
+
+	// only the headers of the final response (after redirects) are kept
+	if (!line.compare(0, 5, "HTTP/"))
+		record->headers.clear();
+	else {
+		string::size_type end = line.find_last_not_of("\r\n");
+		if (end != string::npos)
+			record->headers.push_back(line.substr(0, end + 1));
+	}
+	return size * nmemb;
+}
+
+/**
+ * Stores the response of a completed transfer in the archive, when recording.
+ */
+void Multifetch::archiveResponse(CURL *handle) {
+	HandleState *state = NULL;
+
+	if (curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&state) != CURLE_OK || !state || !state->record)
+		return;
+
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &state->record->status);
+	curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &state->record->ttfb);
+	curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &state->record->total);
+	if (HttpArchive::store(state->archive_dir, *state->record))
+		Logger::warn("Failed to archive the response of '%s'", state->record->url.c_str());
+}
+
+Multifetch::Transfer* Multifetch::startTransfer(CURLM *multi_handle, const string& url, const string& hash, bool hedge) {
+	Transfer *t = new Transfer;
+
+	t->url = url;
+	t->hash = hash;
+	t->hedge = hedge;
+	t->twin = NULL;
+	t->spool = NULL;
+	t->slot = false;
+	t->outcome = FetchStats::OUTCOME_NEUTRAL;
+	t->latency = 0;
+	t->scanner = NULL;
+	t->partial = t->partial_sent = false;
+	t->partial_check = 0;
+	t->path = iConf.computePathFromHash(hash);
+	// each attempt writes aside and only the winner is published
+	t->spool = new SpoolWriter(t->path);
+
+	// watch for progressive scans as data arrives
+	if (!hedge && iConf.getPartialScans() > 0)
+		t->scanner = new JpegScanner();
+
+	// a hedged attempt goes to the next known address of the host
+	if (!(t->handle = setupHandle(url, t->spool, NULL, hedge ? 1 : 0, t->scanner))) {
+		delete t->scanner;
+		delete t->spool;
+		delete t;
+		return NULL;
+	}
+
+	// ...and over a connection of its own
+	if (hedge)
+		curl_easy_setopt(t->handle, CURLOPT_FRESH_CONNECT, (long)1);
+
+	curl_multi_add_handle(multi_handle, t->handle);
+	t->started = FetchStats::now();
+	return t;
+}
+
+size_t Multifetch::writeSpool(char *ptr, size_t size, size_t nmemb, void *userdata) {
+	HandleState *state = NULL;
+	size_t n;
+
+	if (curl_easy_getinfo((CURL *)userdata, CURLINFO_PRIVATE, (char **)&state) != CURLE_OK || !state)
+		return 0;
+
+	if (!state->spool) {
+		n = size * nmemb;
+		if (state->buffer->length() + n > CSSParser::MAX_SIZE)
+			return 0;
+		state->buffer->append(ptr, n);
+		FetchStats::recordBytes(n);
+		if (state->record)
+			state->record->body.append(ptr, n);
+		return n;
+	}
+
+	// reserve room for the whole object as soon as its size is known
+	if (!state->spool->size()) {
+		double cl = -1;
+		if (curl_easy_getinfo((CURL *)userdata, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl) == CURLE_OK && cl > 0)
+			state->spool->preallocate((off_t)cl);
+	}
+
+	n = state->spool->write(ptr, size * nmemb);
+	FetchStats::recordBytes(n);
+	if (state->scanner)
+		state->scanner->feed(ptr, n);
+	if (state->record)
+		state->record->body.append(ptr, n);
+	return n;
+}
+
+/**
+ * Hands the first scans of a progressive JPEG still being fetched to the
+ * classifier. Returns true if the request was sent.
+ */
+bool Multifetch::classifyPartial(Transfer *t) {
+	string partial = t->path + ".partial";
+	double cl = -1;
+	size_t used, total;
+
+	t->partial = true;
+
+	// not worth it for images mostly fetched already
+	curl_easy_getinfo(t->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
+	if (cl > 0 && cl < 2.0 * t->scanner->getScanEnd())
+		return false;
+
+	if (t->spool->flush())
+		return false;
+	if (!JpegScanner::truncate(t->spool->getFd(), partial, iConf.getPartialScans(), used, total))
+		return false;
+
+	Logger::debug("Classifying %s early from its first %lu bytes", t->hash.c_str(), (unsigned long)used);
+	if (consult_nimage_classifier(t->hash, "jpg", NULL, true)) {
+		unlink(partial.c_str());
+		return false;
+	}
+	t->partial_sent = true;
+	return true;
+}
+
+/**
+ * Adds the images referenced by the given stylesheets to the list, from
+ * the stylesheet cache where possible. The rest of the stylesheets are
+ * fetched concurrently and parsed, and their images cached.
+ */
+void Multifetch::fetchStylesheets(const set<string>& css_list, set<string>& url_list) {
+	map<CURL*, pair<string, string*> > fetches; // stylesheet URL and contents per handle
+	map<CURL*, CURLcode> results;
+	CURLM *multi_handle;
+	CURLMsg *msg;
+	int still_running = 0;
+	int msgs_left;
+
+	if (!(multi_handle = curl_multi_init())) {
+		Logger::error("curl_multi_init");
+		return;
+	}
+
+	for (set<string>::const_iterator it = css_list.begin(); it != css_list.end(); it++) {
+		if (CSSParser::lookup(*it, url_list))
+			continue;
+
+		string *buffer = new string;
+		CURL *handle = setupHandle(*it, NULL, NULL, 0, NULL, buffer);
+		if (!handle) {
+			delete buffer;
+			continue;
+		}
+		curl_multi_add_handle(multi_handle, handle);
+		fetches[handle] = make_pair(*it, buffer);
+	}
+
+	if (!fetches.empty())
+		Logger::debug("Fetching %d stylesheets", (int)fetches.size());
+
+	while (!fetches.empty()) {
+		struct timeval timeout;
+		fd_set fdread, fdwrite, fdexcep;
+		int maxfd = -1;
+		long curl_timeo = -1;
+
+		while (curl_multi_perform(multi_handle, &still_running) == CURLM_CALL_MULTI_PERFORM) {}
+
+		while ((msg = curl_multi_info_read(multi_handle, &msgs_left))) {
+			if (msg->msg == CURLMSG_DONE)
+				results[msg->easy_handle] = msg->data.result;
+		}
+		if (!still_running)
+			break;
+
+		FD_ZERO(&fdread);
+		FD_ZERO(&fdwrite);
+		FD_ZERO(&fdexcep);
+
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		curl_multi_timeout(multi_handle, &curl_timeo);
+		if (curl_timeo >= 0) {
+			timeout.tv_sec = curl_timeo / 1000;
+			timeout.tv_usec = (curl_timeo % 1000) * 1000;
+		}
+
+		curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
+		if (select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout) == -1 && errno != EINTR) {
+			perror("select");
+			break;
+		}
+	}
+
+	for (map<CURL*, pair<string, string*> >::iterator it = fetches.begin(); it != fetches.end(); it++) {
+		map<CURL*, CURLcode>::iterator res = results.find(it->first);
+		long http_code = 0;
+
+		if (res != results.end() && res->second == CURLE_OK) {
+			set<string> images;
+			char *effective = NULL;
+
+			archiveResponse(it->first);
+			curl_easy_getinfo(it->first, CURLINFO_RESPONSE_CODE, &http_code);
+			curl_easy_getinfo(it->first, CURLINFO_EFFECTIVE_URL, &effective);
+
+			// relative references are resolved against the stylesheet, after
+			// any redirections; stylesheets that failed are cached (empty) too
+			if (http_code == 200)
+				CSSParser::parseCss(*it->second.second, effective ? effective : it->second.first, images);
+			CSSParser::store(it->second.first, images, iConf.getStylesheetTTL());
+			url_list.insert(images.begin(), images.end());
+		} else {
+			// oversized or unreachable stylesheets are not fetched again until the entry expires
+			Logger::debug("Failed to fetch stylesheet %s", it->second.first.c_str());
+			CSSParser::store(it->second.first, set<string>(), iConf.getStylesheetTTL());
+		}
+
+		curl_multi_remove_handle(multi_handle, it->first);
+		cleanupHandle(it->first);
+		delete it->second.second;
+	}
+	curl_multi_cleanup(multi_handle);
+}
+
+void Multifetch::dropTransfer(CURLM *multi_handle, Transfer *t) {
+	if (t->slot) {
+		string host, port;
+		DnsCache::splitUrl(t->url, host, port);
+		FetchStats::releaseSlot(t->outcome, t->latency, host);
+	}
+	if (multi_handle)
+		curl_multi_remove_handle(multi_handle, t->handle);
+	cleanupHandle(t->handle);
+	if (t->spool)
+		delete t->spool;
+	if (t->scanner)
+		delete t->scanner;
+	delete t;
+}
+
 int Multifetch::fetch_multi_from_list(const set<string>& url_set, DbCache *cache) {
 	int still_running = 1; /* keep number of running handles */
 	int cur_idx, k, size, concur;
@@ -122,18 +478,19 @@ int Multifetch::fetch_multi_from_list(const set<string>& url_set, DbCache *cache
 		return 0;
 	}
 
-	set<string>::iterator uit = url_set.begin();
-	for(int i = 0; i < size; i++, uit++) {
-		// cache url if there is no caching entry for this url already
-		string cur_hash;
-		int err = cache->insertUrlEntry(*uit, cur_hash);
-		switch (err) {
+	// cache urls there is no caching entry for already, in one go
+	vector<string> urls(url_set.begin(), url_set.end()), hashes;
+	vector<int> inserted;
+	cache->insertUrlEntries(urls, hashes, inserted);
+
+	for(int i = 0; i < size; i++) {
+		switch (inserted[i]) {
 			case 1:
-				indices.insert(pair<string, string>(*uit, cur_hash));
+				indices.insert(pair<string, string>(urls[i], hashes[i]));
 				break;
 			case -1:
-				Logger::info("URL %s already in cache. Skipping...", uit->c_str());
-				waitfor.insert(cur_hash);
+				Logger::info("URL %s already in cache. Skipping...", urls[i].c_str());
+				waitfor.insert(hashes[i]);
 				break;
 			case 0:
 			default:
@@ -147,53 +504,29 @@ int Multifetch::fetch_multi_from_list(const set<string>& url_set, DbCache *cache
 	concur = ((iConf.getMaxXfers() > 0) ? ((size > iConf.getMaxXfers()) ? iConf.getMaxXfers() : size) : size);
 
 	// constructing network I/O handlers for each newly-inserted image url in the image pool
-	CURL **handles = NULL;
-	string *handleURLs = NULL;
-	DbCache **caches = NULL;
-	FILE **fps = NULL;
+	map<CURL*, Transfer*> active;
 	CURLM *multi_handle = NULL;
+	int jobs = 0; // objects being transferred, not counting hedged attempts
 
-	if (!(handles = new CURL*[concur]) ||
-			!(handleURLs = new string[concur]) ||
-			!(caches = new DbCache *[concur]) ||
-			!(fps = new FILE *[concur]) ||
-			!(multi_handle = curl_multi_init())) {
-		Logger::error("new");
+	if (size && !(multi_handle = curl_multi_init())) {
+		Logger::error("curl_multi_init");
 
 		for(set<pair<string, string> >::iterator uit = indices.begin(); uit != indices.end(); uit++)
 			cache->updateUrlStatus(uit->second, InfernoConf::STATUS_FAILURE);
-
-		if (handles)
-			delete[] handles;
-		if (handleURLs)
-			delete[] handleURLs;
-		if (caches)
-			delete[] caches;
-		if (fps)
-			delete[] fps;
-		if (multi_handle)
-			curl_multi_cleanup(multi_handle);
 		return 0;
 	}
 
-	set<pair<string, string> >::iterator it = indices.begin();
-	for(cur_idx = 0; cur_idx < concur; cur_idx++, it++) {
-		// associate a new cache server connection with handle
-		// XXX: examine pooling or sharing to avoid a new connection per thread
-		caches[cur_idx] = new DbCache();
-		if (!caches[cur_idx] || caches[cur_idx]->init(iConf)) {
-			Logger::error("Unable to initialize database client");
-			pthread_exit(NULL);
-		}
+#ifdef CURLPIPE_MULTIPLEX
+	// multiplex same-origin transfers over a single HTTP/2 connection
+	if (multi_handle && curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX) != CURLM_OK)
+		Logger::debug("Failed enabling HTTP/2 multiplexing");
+#endif
 
-		// add new curl_easy
-		handles[cur_idx] = setupHandle(it->first, it->second, fps[cur_idx]);
-		handleURLs[cur_idx] = it->second;
-		curl_multi_add_handle(multi_handle, handles[cur_idx]);
-	}
+	set<pair<string, string> >::iterator it = indices.begin();
+	cur_idx = 0;
 
 	Logger::debug("Initiating concurrent downloads");
-	do {
+	while (true) {
 		struct timeval timeout;
 		int rc; // select() return code
 
@@ -201,216 +534,342 @@ int Multifetch::fetch_multi_from_list(const set<string>& url_set, DbCache *cache
 		fd_set fdwrite;
 		fd_set fdexcep;
 
-		while (still_running) {
+		int maxfd = -1;
+		long curl_timeo = -1;
+
+		// keep the transfer pool full, as far as the transfer window allows;
+		// each request gets at least one transfer going regardless
+		for (; it != indices.end() && jobs < concur; it++) {
+			// a background crawl gives way to live requests, leaving the
+			// images not started yet for them to fetch
+			if (background && Prefetcher::preempted()) {
+				for (; it != indices.end(); it++)
+					cache->removeUrlEntry(it->second);
+				cancelled = true;
+				break;
+			}
+			if (!FetchStats::acquireSlot(iConf.getMaxXfers(), jobs == 0))
+				break;
+			Transfer *t = startTransfer(multi_handle, it->first, it->second, false);
+			if (!t) {
+				FetchStats::releaseSlot(FetchStats::OUTCOME_NEUTRAL, 0);
+				cache->updateUrlFailure(it->second, "transfer setup failed");
+				continue;
+			}
+			t->slot = true;
+			active[t->handle] = t;
+			FetchStats::recordTransfer();
+			jobs++;
+			cur_idx++;
+		}
 
-			int maxfd = -1;
-			long curl_timeo = -1;
+		if (active.empty())
+			break;
 
-			FD_ZERO(&fdread);
-			FD_ZERO(&fdwrite);
-			FD_ZERO(&fdexcep);
+		FD_ZERO(&fdread);
+		FD_ZERO(&fdwrite);
+		FD_ZERO(&fdexcep);
 
-			for (CURLMcode retCode = CURLM_CALL_MULTI_PERFORM;
-					retCode == CURLM_CALL_MULTI_PERFORM;
-					retCode = curl_multi_perform(multi_handle, &still_running)) {}
+		for (CURLMcode retCode = CURLM_CALL_MULTI_PERFORM;
+				retCode == CURLM_CALL_MULTI_PERFORM;
+				retCode = curl_multi_perform(multi_handle, &still_running)) {}
 
-			// set a suitable timeout to play around with
-			timeout.tv_sec = 1;
-			timeout.tv_usec = 0;
+		// set a suitable timeout to play around with
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
 
-			curl_multi_timeout(multi_handle, &curl_timeo);
+		curl_multi_timeout(multi_handle, &curl_timeo);
 
-			if(curl_timeo >= 0) {
-				timeout.tv_sec = curl_timeo / 1000;
-				timeout.tv_usec = (curl_timeo % 1000) * 1000;
-			}
+		if(curl_timeo >= 0) {
+			timeout.tv_sec = curl_timeo / 1000;
+			timeout.tv_usec = (curl_timeo % 1000) * 1000;
+		}
+
+		// check back soon for slots freed by other requests
+		if (it != indices.end() && jobs < concur && (timeout.tv_sec > 0 || timeout.tv_usec > 100000)) {
+			timeout.tv_sec = 0;
+			timeout.tv_usec = 100000;
+		}
 
-			/* get file descriptors from the transfers */
-			curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
-
-			/* In a real-world program you OF COURSE check the return code of the
-			   function calls.  On success, the value of maxfd is guaranteed to be
-			   greater or equal than -1.  We call select(maxfd + 1, ...), specially in
-			   case of (maxfd == -1), we call select(0, ...), which is basically equal
-			   to sleep. */
-
-			rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
-			switch(rc) {
-				case -1:
-					/* select error */
-					if (errno != EINTR) {
-						perror("select");
-						for(int x = 0; x < concur; x++)
-							if (caches[x])
-								delete caches[x];
-						delete[] caches;
-						for(int x = 0; x < concur; x++)
-							if (fps[x])
-								fclose(fps[x]);
-						delete[] fps;
-						delete[] handles;
-						delete[] handleURLs;
-						return 0;
+		/* get file descriptors from the transfers */
+		curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
+
+		/* On success, the value of maxfd is guaranteed to be greater or
+		   equal than -1.  We call select(maxfd + 1, ...), specially in
+		   case of (maxfd == -1), we call select(0, ...), which is basically
+		   equal to sleep. */
+
+		rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
+		switch(rc) {
+			case -1:
+				/* select error */
+				if (errno != EINTR) {
+					perror("select");
+					for (map<CURL*, Transfer*>::iterator ait = active.begin(); ait != active.end(); ait++) {
+						if (!ait->second->hedge)
+							cache->updateUrlFailure(ait->second->hash, "transfer aborted");
+						dropTransfer(multi_handle, ait->second);
 					}
+					curl_multi_cleanup(multi_handle);
+					return 0;
+				}
+				break;
+			case 0: /* timeout */
+			default: /* action */
+				curl_multi_perform(multi_handle, &still_running);
+				break;
+		}
+
+		// hedge transfers that take longer than most recent ones did
+		double threshold;
+		if (!background && FetchStats::percentile(iConf.getHedgePercentile(), threshold)) {
+			double now = FetchStats::now();
+			for (map<CURL*, Transfer*>::iterator ait = active.begin(); ait != active.end(); ait++) {
+				Transfer *t = ait->second;
+				if (t->hedge || t->twin || now - t->started < threshold)
+					continue;
+				if (!FetchStats::acquireSlot(iConf.getMaxXfers(), false))
 					break;
-				case 0: /* timeout */
-				default: /* action */
-					curl_multi_perform(multi_handle, &still_running);
+				if (!FetchStats::acquireHedge(iConf.getHedgeRatio())) {
+					FetchStats::releaseSlot(FetchStats::OUTCOME_NEUTRAL, 0);
 					break;
+				}
+
+				Transfer *h = startTransfer(multi_handle, t->url, t->hash, true);
+				if (!h) {
+					FetchStats::releaseSlot(FetchStats::OUTCOME_NEUTRAL, 0);
+					continue;
+				}
+				h->slot = true;
+				Logger::debug("Hedging transfer of %s after %.3lf secs", t->url.c_str(), now - t->started);
+				h->twin = t;
+				t->twin = h;
+				active[h->handle] = h;
 			}
+		}
 
-			// XXX: Do this in-line to avoid waiting for all the transfers to complete before starting the classification chores
-			while ((msg = curl_multi_info_read(multi_handle, &msgs_left))) {
-				if (msg->msg == CURLMSG_DONE) { // XXX: no other msg types defined at this time per curl_multi_info_read(3)
-					CURL *cur_handle = msg->easy_handle;
-					int idx;
+		// classify progressive JPEGs early from their first scans, and abort
+		// the transfers whose verdict is already in
+		if (iConf.getPartialScans() > 0) {
+			double now = FetchStats::now();
+			vector<Transfer*> decided;
+
+			for (map<CURL*, Transfer*>::iterator ait = active.begin(); ait != active.end(); ait++) {
+				Transfer *t = ait->second;
+				if (!t->scanner)
+					continue;
+				if (!t->partial) {
+					if (t->scanner->getScans() >= iConf.getPartialScans() && classifyPartial(t))
+						t->partial_check = now;
+					continue;
+				}
+				if (!t->partial_sent || now - t->partial_check < iConf.getPollInterval() / 1000000.0)
+					continue;
+				t->partial_check = now;
+				if (cache->lookupUrlStatus(t->hash) == InfernoConf::STATUS_DONE)
+					decided.push_back(t);
+			}
 
-					// get index of current handle in the handles store
-					for (idx = 0; idx < concur && cur_handle != handles[idx]; idx++) {}
-					const char* cur_url = handleURLs[idx].c_str();
+			for (vector<Transfer*>::iterator dit = decided.begin(); dit != decided.end(); dit++) {
+				Transfer *t = *dit;
+				double cl = -1, dl = 0;
 
-					Logger::debug("HTTP transfer for %s completed with status %d", (cur_url ? cur_url : "[N/A]"), msg->data.result);
+				curl_easy_getinfo(t->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
+				curl_easy_getinfo(t->handle, CURLINFO_SIZE_DOWNLOAD, &dl);
+				Logger::info("Image %s classified early, aborting transfer after %.0lf of %.0lf bytes", t->hash.c_str(), dl, cl);
+				FetchStats::recordEarlyVerdict((cl > dl) ? cl - dl : 0);
 
-					if (msg->data.result == CURLE_OK) {
-						double cl; // content length buffer
-						char *ct = NULL;
-						long http_code = 0;
+				if (t->twin) {
+					active.erase(t->twin->handle);
+					dropTransfer(multi_handle, t->twin);
+				}
+				active.erase(t->handle);
+				waitfor.insert(t->hash);
+				dropTransfer(multi_handle, t);
+				jobs--;
+			}
+		}
 
-						// get content length header field that the server sent to us
-						code = curl_easy_getinfo(cur_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
+		// XXX: Do this in-line to avoid waiting for all the transfers to complete before starting the classification chores
+		while ((msg = curl_multi_info_read(multi_handle, &msgs_left))) {
+			if (msg->msg != CURLMSG_DONE) // XXX: no other msg types defined at this time per curl_multi_info_read(3)
+				continue;
 
-						// get content type field that the server sent to us
-						code = curl_easy_getinfo(cur_handle, CURLINFO_CONTENT_TYPE, &ct);
-						if (ct)
-							cache->updateUrlContentType(cur_url, ct);
+			map<CURL*, Transfer*>::iterator ait = active.find(msg->easy_handle);
+			if (ait == active.end())
+				continue;
 
-						// get HTTP response code
-						code = curl_easy_getinfo(cur_handle, CURLINFO_RESPONSE_CODE, &http_code);
+			Transfer *t = ait->second;
+			CURLcode result = msg->data.result;
+			active.erase(ait);
+
+			Logger::debug("HTTP transfer %sfor %s completed with status %d", (t->hedge ? "(hedged) " : ""), t->hash.c_str(), result);
+
+			// feed the transfer window: timeouts, refused connections and
+			// throttling responses shrink it, successful transfers grow it
+			if (result == CURLE_OK) {
+				double pre = 0, start = 0;
+				long http_code = 0;
+
+				curl_easy_getinfo(t->handle, CURLINFO_PRETRANSFER_TIME, &pre);
+				curl_easy_getinfo(t->handle, CURLINFO_STARTTRANSFER_TIME, &start);
+				curl_easy_getinfo(t->handle, CURLINFO_RESPONSE_CODE, &http_code);
+				t->latency = start - pre;
+				t->outcome = (http_code == 429 || http_code == 503) ? FetchStats::OUTCOME_CONGESTED : FetchStats::OUTCOME_OK;
+			} else if (result == CURLE_OPERATION_TIMEDOUT || result == CURLE_COULDNT_CONNECT)
+				t->outcome = FetchStats::OUTCOME_CONGESTED;
+
+			if (t->twin) {
+				Transfer *twin = t->twin;
+				twin->twin = NULL;
+				t->twin = NULL;
+
+				if (result != CURLE_OK) {
+					// the other attempt may still make it; let it go on
+					dropTransfer(multi_handle, t);
+					continue;
+				}
 
-						// see if we had a successful transfer
-						//XXX: successful transfers are always indicated by a HTTP 200 response code
-						if(http_code == 200 && code != CURLE_ABORTED_BY_CALLBACK) {
-							//Logger::debug("URL '%s' fetched with a HTTP 200 response code. SUCCESS!", cur_url.c_str());
+				// first to finish wins; the slower attempt is cancelled
+				active.erase(twin->handle);
+				dropTransfer(multi_handle, twin);
+			}
 
-							//XXX: or see if HTTP headers are missing
-						} else if(ct == NULL && http_code != 200) {
-							Logger::warn("URL %s without headers (Content-type: null, HTTP code: %d)! Probing next image...", cur_url, http_code);
-							Logger::debug("Updating image status for %s to 'FAILURE'", cur_url);
-							if(!caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE)) {
-								Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", caches[idx]->getErrorString());
-							}
+			if (result == CURLE_OK) {
+				FetchStats::recordFetch(FetchStats::now() - t->started);
+				archiveResponse(t->handle);
+			}
 
-							goto cleanup_curl_handle;
-						}
+			CURL *cur_handle = t->handle;
+			const char* cur_url = t->hash.c_str();
 
-						/* detrmine mime-type of fetched object */
-						for(k = known_flag = 0; (InfernoConf::img_mimes[k] != NULL) && (known_flag == 0); k++) {
-							if(!strncasecmp(ct, InfernoConf::img_mimes[k], strlen(InfernoConf::img_mimes[k]))) {
-								known_flag = 1;
-							}
-						}
+			// an early verdict may have made it in just before completion
+			if (t->partial_sent && cache->lookupUrlStatus(t->hash) == InfernoConf::STATUS_DONE) {
+				waitfor.insert(t->hash);
+				goto cleanup_curl_handle;
+			}
 
-						if(!known_flag) {
-							Logger::warn("The remote web server included an unknown image MIME-type (%s) for this object. Ignoring item", ct);
-							Logger::debug("Updating image status for '%s' to 'FAILURE'", cur_url);
-							if(!caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE)) {
-								Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", caches[idx]->getErrorString());
-							}
+			if (result == CURLE_OK) {
+				double cl; // content length buffer
+				char *ct = NULL;
+				long http_code = 0;
+
+				// get content length header field that the server sent to us
+				code = curl_easy_getinfo(cur_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
+
+				// get content type field that the server sent to us
+				code = curl_easy_getinfo(cur_handle, CURLINFO_CONTENT_TYPE, &ct);
+				if (ct)
+					cache->updateUrlContentType(cur_url, ct);
+
+				// get HTTP response code
+				code = curl_easy_getinfo(cur_handle, CURLINFO_RESPONSE_CODE, &http_code);
+
+				// see if we had a successful transfer
+				//XXX: successful transfers are always indicated by a HTTP 200 response code
+				if(http_code == 200 && code != CURLE_ABORTED_BY_CALLBACK) {
+					//Logger::debug("URL '%s' fetched with a HTTP 200 response code. SUCCESS!", cur_url.c_str());
+
+					//XXX: or see if HTTP headers are missing
+				} else if(ct == NULL && http_code != 200) {
+					Logger::warn("URL %s without headers (Content-type: null, HTTP code: %d)! Probing next image...", cur_url, http_code);
+					Logger::debug("Updating image status for %s to 'FAILURE'", cur_url);
+					char reason[32];
+					snprintf(reason, sizeof(reason), "HTTP %ld", http_code);
+					if(!cache->updateUrlFailure(cur_url, reason)) {
+						Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", cache->getErrorString());
+					}
 
-							goto cleanup_curl_handle;
-						}
+					goto cleanup_curl_handle;
+				}
 
-						Logger::debug("Updating image status for '%s' to 'PROCESSING'", cur_url);
+				/* detrmine mime-type of fetched object */
+				for(k = known_flag = 0; (InfernoConf::img_mimes[k] != NULL) && (known_flag == 0); k++) {
+					if(!strncasecmp(ct, InfernoConf::img_mimes[k], strlen(InfernoConf::img_mimes[k]))) {
+						known_flag = 1;
+					}
+				}
 
-						if(!caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_PROCESSING)) {
-							Logger::error("Error updating image status to PROCESSING. Error report: %s", caches[idx]->getErrorString());
-							caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE);
-							goto cleanup_curl_handle;
-						}
+				if(!known_flag) {
+					Logger::warn("The remote web server included an unknown image MIME-type (%s) for this object. Ignoring item", ct);
+					Logger::debug("Updating image status for '%s' to 'FAILURE'", cur_url);
+					if(!cache->updateUrlFailure(cur_url, string("unknown content type ") + ct)) {
+						Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", cache->getErrorString());
+					}
 
+					goto cleanup_curl_handle;
+				}
 
-						Logger::debug("Updating image classification status for '%s' to 'CLASSIFYING'", cur_url);
-						if(!caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_CLASSIFYING)) {
-							Logger::error("Error updating status of image url. Error report: %s", caches[idx]->getErrorString());
-							caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE);
-							goto cleanup_curl_handle;
-						}
+				Logger::debug("Updating image status for '%s' to 'PROCESSING'", cur_url);
 
-						if (fclose(fps[idx])) {
-							Logger::error("fclose");
-						}
-						fps[idx] = NULL;
-						//XXX: invoke classifier here
-						Logger::debug("Invoking classifier for this image...");
-
-						// request the network image classifier to
-						// classify image per path
-						if (consult_nimage_classifier(cur_url, InfernoConf::img_ext[k-1], NULL)) {
-							Logger::debug("Updating image status for '%s' to 'FAILURE'", cur_url);
-							if(!caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE)) {
-								Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", caches[idx]->getErrorString());
-								goto cleanup_curl_handle;
-							}
-						} else
-							waitfor.insert(cur_url);
-					} else {
-						Logger::debug("Updating image status for '%s' to 'FAILURE'", cur_url);
-						if(!caches[idx]->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE)) {
-							Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", caches[idx]->getErrorString());
-						}
-					}
+				if(!cache->updateUrlStatus(cur_url, InfernoConf::STATUS_PROCESSING)) {
+					Logger::error("Error updating image status to PROCESSING. Error report: %s", cache->getErrorString());
+					cache->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE);
+					goto cleanup_curl_handle;
+				}
 
-cleanup_curl_handle:
-					// remove multi handle and clean-up current i/o handler
-
-					if (it != indices.end()) {
-						delete caches[idx];
-						caches[idx] = new DbCache();
-						if (!caches[idx] || caches[idx]->init(iConf)) {
-							Logger::error("Unable to initialize database client");
-							pthread_exit(NULL);
-						}
-						if (fps[idx])
-							fclose(fps[idx]);
-						handles[idx] = setupHandle(it->first, it->second, fps[idx]);
-						handleURLs[idx] = it->second;
-						curl_multi_add_handle(multi_handle, handles[idx]);
-						cur_idx++;
-						it++;
-					}
 
-					curl_multi_remove_handle(multi_handle, cur_handle);
-					curl_easy_cleanup(cur_handle);
+				Logger::debug("Updating image classification status for '%s' to 'CLASSIFYING'", cur_url);
+				if(!cache->updateUrlStatus(cur_url, InfernoConf::STATUS_CLASSIFYING)) {
+					Logger::error("Error updating status of image url. Error report: %s", cache->getErrorString());
+					cache->updateUrlStatus(cur_url, InfernoConf::STATUS_FAILURE);
+					goto cleanup_curl_handle;
+				}
+
+				// only complete objects ever show up in the spool
+				if (t->spool->publish()) {
+					cache->updateUrlFailure(cur_url, "spool file publication failed");
+					goto cleanup_curl_handle;
+				}
+				//XXX: invoke classifier here
+				Logger::debug("Invoking classifier for this image...");
+
+				// request the network image classifier to
+				// classify image per path
+				if (consult_nimage_classifier(cur_url, InfernoConf::img_ext[k-1], NULL)) {
+					// back off while the classifier is overloaded or down
+					t->outcome = FetchStats::OUTCOME_CONGESTED;
+					Logger::debug("Updating image status for '%s' to 'FAILURE'", cur_url);
+					if(!cache->updateUrlFailure(cur_url, "classifier unavailable")) {
+						Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", cache->getErrorString());
+						goto cleanup_curl_handle;
+					}
+				} else
+					waitfor.insert(cur_url);
+			} else {
+				Logger::debug("Updating image status for '%s' to 'FAILURE'", cur_url);
+				if(!cache->updateUrlFailure(cur_url, curl_easy_strerror(result))) {
+					Logger::error("Error updating image URL status to 'FAILURE'. Error report: %s", cache->getErrorString());
 				}
 			}
-		}
-	} while (still_running);
-	// cleaning up multi handler
-	curl_multi_cleanup(multi_handle);
 
-	/* cleaning up cache connections */
-	for (int i = 0; i < concur; i++)
-		if (caches[i])
-			delete caches[i];
-	delete[] caches;
-	for(int x = 0; x < concur; x++)
-		if (fps[x]) {
-			fclose(fps[x]);
+cleanup_curl_handle:
+			// remove multi handle and clean-up current i/o handler
+			dropTransfer(multi_handle, t);
+			jobs--;
 		}
-	delete[] fps;
-	delete[] handles;
-	delete[] handleURLs;
+	}
+	// cleaning up multi handler
+	if (multi_handle)
+		curl_multi_cleanup(multi_handle);
 
 	Logger::debug("Exiting multithreaded image downloader routine with %d out of %d handles done", cur_idx, size);
 
 	while (waitfor.size()) {
+		// look all the images being waited for up at once, whenever a
+		// verdict comes in on one of them
+		map<string, unsigned int> seen;
+		map<string, UrlRecord> records;
+		for (set<string>::iterator it = waitfor.begin(); it != waitfor.end(); it++)
+			seen[*it] = VerdictBus::sequence(iConf, *it);
+		cache->lookupUrlRecords(waitfor, records);
+
 		for (set<string>::iterator it = waitfor.begin(); it != waitfor.end(); ) {
-			InfernoConf::Status status = cache->lookupUrlStatus(*it);
-			InfernoConf::Classification cres = InfernoConf::CLASS_UNDEFINED;
+			map<string, UrlRecord>::iterator rit = records.find(*it);
+			InfernoConf::Status status = (rit != records.end()) ? rit->second.status : InfernoConf::STATUS_ERROR;
 			switch (status) {
 				case InfernoConf::STATUS_DONE:
-					cres = cache->lookupUrlClassification(*it);
-					switch (cres) {
+					switch (rit->second.decision) {
 						case InfernoConf::CLASS_PORN:
 							porn_count++;
 							break;
@@ -432,22 +891,53 @@ cleanup_curl_handle:
 					it++;
 			}
 		}
+		// the page is only done once all of them are, so waiting for any
+		// single one of them will do
 		if (waitfor.size())
-			usleep(iConf.getPollInterval());
+			VerdictBus::wait(iConf, seen[*waitfor.begin()], *waitfor.begin());
 	}
 
 	return 1;
 }
 
 InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, string& url_pt_hash, string& ctype) {
+	InfernoConf::Classification ret;
+
+	if (background)
+		return fetchPage(url_pt, url_pt_hash, ctype);
+
+	// background crawls only run while no live request is being served
+	Prefetcher::liveBegin();
+	ret = fetchPage(url_pt, url_pt_hash, ctype);
+	Prefetcher::liveEnd();
+	return ret;
+}
+
+/**
+ * Aborts the page transfer of a background crawl once live requests come in.
+ */
+int Multifetch::progressBackground(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow) {
+	(void)clientp;
+	(void)dltotal;
+	(void)dlnow;
+	(void)ultotal;
+	(void)ulnow;
+	return Prefetcher::preempted() ? 1 : 0;
+}
+
+InfernoConf::Classification Multifetch::fetchPage(const string& url_pt, string& url_pt_hash, string& ctype) {
 	// local variables
 	CURL *conn = NULL;
 	CURLcode code;
 	DbCache *cache;
 	InfernoConf::Classification ret = InfernoConf::CLASS_ERROR;
 	int status;
-	FILE *htmlFile;
+	SpoolWriter htmlFile("");
 	double p_ratio = 0;
+	int takeovers = 0;
+	set<string> url_list;
+	set<string> link_list;
+	set<string> css_list;
 
 	if (url_pt.empty())
 		return InfernoConf::CLASS_ERROR;
@@ -459,24 +949,38 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 
 	// create new cache client
 	Logger::debug("Establishing connection to caching server");
-	cache = new DbCache();
-	if(cache->init(iConf) || !cache->connect()) {
-		delete cache;
+	if (!(cache = DbPool::checkout(iConf))) {
 		delete[] errorBuffer;
-		Logger::error("Could not connect to caching server. Error report: %s", cache->getErrorString());
+		Logger::error("Could not connect to caching server");
 		return InfernoConf::CLASS_ERROR;
 	}
 
+claim_entry:
 	if((status = cache->insertUrlEntry(url_pt, url_pt_hash)) == -1) {
 		Logger::debug("An entry already exists in cache for the entered URL. Delegating content to the user according to previous classification");
 
-		InfernoConf::Status dbstatus;
-		while ((dbstatus = cache->lookupUrlStatus(url_pt_hash)) != InfernoConf::STATUS_DONE && dbstatus != InfernoConf::STATUS_FAILURE && dbstatus != InfernoConf::STATUS_ERROR)
-			usleep(iConf.getPollInterval());
+		UrlRecord record;
+		unsigned int seen = VerdictBus::sequence(iConf, url_pt_hash);
+		while (cache->lookupUrlRecord(url_pt_hash, record) && record.status != InfernoConf::STATUS_DONE && record.status != InfernoConf::STATUS_FAILURE) {
+			VerdictBus::wait(iConf, seen, url_pt_hash);
+			seen = VerdictBus::sequence(iConf, url_pt_hash);
+		}
+		InfernoConf::Status dbstatus = record.status;
+
+		// a background crawl that gave way to us leaves no entry behind;
+		// fetch the page here instead
+		if (dbstatus == InfernoConf::STATUS_ERROR && !takeovers++)
+			goto claim_entry;
+
+		// don't hammer origins that failed recently; wait for the back-off period to elapse
+		if (dbstatus == InfernoConf::STATUS_FAILURE) {
+			Logger::debug("Previous attempt to fetch %s failed. Backing off...", url_pt.c_str());
+			goto terminate_session;
+		}
 
 		// see what are previous classification was about this url
-		InfernoConf::Classification ret = cache->lookupUrlClassification(url_pt_hash);
-		ctype = cache->lookupUrlContentType(url_pt_hash);
+		ret = record.decision;
+		ctype = record.ctype;
 
 		switch(ret) {
 			case InfernoConf::CLASS_PORN:
@@ -495,35 +999,44 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 				Logger::debug("Error occured in classification.");
 		}
 
-		// terminate caching server connection
-		delete cache;
-		delete[] errorBuffer;
-		return ret;
+		goto terminate_session;
 	} else if (status == 0) {
-		delete cache;
-		delete[] errorBuffer;
 		Logger::error("Error inserting fresh URL entry on cache. Error report: %s", cache->getErrorString());
-		return InfernoConf::CLASS_ERROR;
+		goto terminate_session;
 	}
 
+	// the spool path is only known once the entry has been hashed
+	htmlFile.setPath(iConf.computePathFromHash(url_pt_hash));
+
 	// initialize connection to the remote web server
-	if (!(conn = setupHandle(url_pt, url_pt_hash, htmlFile, errorBuffer))) {
+	if (!(conn = setupHandle(url_pt, &htmlFile, errorBuffer))) {
 		Logger::debug("initConnection: connection initialization failed");
-		delete cache;
-		delete[] errorBuffer;
-		return InfernoConf::CLASS_ERROR;
+		goto terminate_session;
 	}
 
+	if (background && (curl_easy_setopt(conn, CURLOPT_NOPROGRESS, (long)0) != CURLE_OK ||
+				curl_easy_setopt(conn, CURLOPT_PROGRESSFUNCTION, progressBackground) != CURLE_OK))
+		Logger::debug("Failed to make the crawl-ahead of '%s' cancellable", url_pt.c_str());
+
 	Logger::debug("Caching new URL entry, and updating URL's entry status to 'FETCHING'");
 	// fetch content from the remote web server pointed to by the input URL
 	code = curl_easy_perform(conn);
-	fclose(htmlFile);
+	if(code == CURLE_ABORTED_BY_CALLBACK && background) {
+		Logger::debug("Crawl-ahead of '%s' cancelled", url_pt.c_str());
+		cache->removeUrlEntry(url_pt_hash);
+		goto terminate_session;
+	}
+	if(code == CURLE_OK)
+		archiveResponse(conn);
+	if(code == CURLE_OK && htmlFile.publish()) {
+		Logger::error("Failed to publish the spool file of '%s'", url_pt.c_str());
+		cache->updateUrlFailure(url_pt_hash, "spool file publication failed");
+		goto terminate_session;
+	}
 	if(code != CURLE_OK) {
 		Logger::error("curl_easy_perform: failed to fetch contents of '%s' [error: '%s']", url_pt.c_str(), errorBuffer);
-		cache->updateUrlStatus(url_pt_hash, InfernoConf::STATUS_FAILURE);
-		delete cache;
-		delete[] errorBuffer;
-		return InfernoConf::CLASS_ERROR;
+		cache->updateUrlFailure(url_pt_hash, curl_easy_strerror(code));
+		goto terminate_session;
 	}
 
 	double contentLength;
@@ -531,9 +1044,7 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 	if (code != CURLE_OK) {
 		Logger::error("curl_easy_getinfo: failed to fetch content length of '%s' [error: '%s']", url_pt.c_str(), errorBuffer);
 		cache->updateUrlStatus(url_pt_hash, InfernoConf::STATUS_FAILURE);
-		delete cache;
-		delete[] errorBuffer;
-		return InfernoConf::CLASS_ERROR;
+		goto terminate_session;
 	}
 
 	/* at this point we need to check if the remote object is an HTML page or an image, or something else... */
@@ -564,17 +1075,19 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 				InfernoConf::Classification cres = InfernoConf::CLASS_UNDEFINED;
 				if (consult_nimage_classifier(url_pt_hash, InfernoConf::img_ext[i])) {
 					Logger::debug("Updating image status to 'FAILURE'");
-					if(!cache->updateUrlStatus(url_pt_hash, InfernoConf::STATUS_FAILURE)) {
+					if(!cache->updateUrlFailure(url_pt_hash, "classifier unavailable")) {
 						Logger::error("Error updating url's status to 'FAILURE'");
 					}
 					cres = InfernoConf::CLASS_ERROR;
 				} else {
 					bool waiting = true;
 					while (waiting) {
-						InfernoConf::Status status = cache->lookupUrlStatus(url_pt_hash);
-						switch (status) {
+						unsigned int seen = VerdictBus::sequence(iConf, url_pt_hash);
+						UrlRecord record;
+						cache->lookupUrlRecord(url_pt_hash, record);
+						switch (record.status) {
 							case InfernoConf::STATUS_DONE:
-								cres = cache->lookupUrlClassification(url_pt_hash);
+								cres = record.decision;
 								switch (cres) {
 									case InfernoConf::CLASS_PORN:
 										porn_count++;
@@ -595,15 +1108,15 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 							default:
 								;
 						}
-						usleep(iConf.getPollInterval());
+						if (waiting)
+							VerdictBus::wait(iConf, seen, url_pt_hash);
 					}
 				}
 
 				Logger::debug("Delegating image to the user based on the classification (%d)", cres);
 
-				delete cache;
-				delete[] errorBuffer;
-				return cres;
+				ret = cres;
+				goto terminate_session;
 			}
 		}
 	}
@@ -637,15 +1150,23 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 		Logger::debug("Forwarding content to the user anyway!");
 
 		//TODO: terminate user session in terms of c-icap calls here
-		delete cache;
-		delete[] errorBuffer;
-		return ret;
+		goto terminate_session;
 	}
 
-	set<string> url_list;
-
 	// invoke parser
-	HTMLParser::parseHtml(iConf.computePathFromHash(url_pt_hash), url_pt, url_list);
+	HTMLParser::parseHtml(iConf.computePathFromHash(url_pt_hash), url_pt, url_list, iConf.getMinImageWidth(),
+			(!background && iConf.getPrefetchLinks() > 0) ? &link_list : NULL, &css_list);
+
+	// add the background images of linked stylesheets
+	if (!css_list.empty())
+		fetchStylesheets(css_list, url_list);
+
+	// the next page visited is likely one of those linked from this one
+	if (!link_list.empty())
+		Prefetcher::enqueue(link_list, iConf);
+
+	// start resolving the image hosts while the image entries are being cached
+	DnsCache::prefetch(url_list, iConf.getDnsCacheTTL());
 
 	Logger::info("Determined URL pool size is = %d", (int)url_list.size());
 	Logger::info("Dumping URLs in image pool:");
@@ -683,9 +1204,7 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 
 		//TODO: terminate current user session
 		Logger::debug("Cleaning up session...");
-		delete cache;
-		delete[] errorBuffer;
-		return ret;
+		goto terminate_session;
 	}
 
 	// set web page status to processing
@@ -701,6 +1220,12 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 	Logger::debug("Invoking multithreaded image download manager for these images...");
 	fetch_multi_from_list(url_list, cache);
 
+	if (cancelled) {
+		Logger::debug("Crawl-ahead of '%s' cancelled", url_pt.c_str());
+		cache->removeUrlEntry(url_pt_hash);
+		goto terminate_session;
+	}
+
 	// fuse web page
 	Logger::debug("Fusing scores of images into a page-wide classification.");
 
@@ -741,11 +1266,11 @@ InfernoConf::Classification Multifetch::extractlinks(const string& url_pt, strin
 terminate_session:
 	//TODO: terminate current session via c-icap
 	Logger::debug("Terminating session...");
-	delete cache;
+	DbPool::checkin(cache);
 	delete[] errorBuffer;
 
 	// clean-up curl
-	curl_easy_cleanup(conn);
+	cleanupHandle(conn);
 
 	// exit broker
 	return ret;
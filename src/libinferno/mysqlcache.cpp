@@ -0,0 +1,1051 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <mysql.h>
+
+#include "errmsg.h"
+#include "mysqld_error.h"
+#include "mysqlcache.h"
+#include "verdictbus.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const time_t MysqlCache::IDLE_CHECK = 30;
+const size_t MysqlCache::BATCH_ROWS = 256;
+const size_t MysqlCache::MAX_CTYPE = 255;
+
+static void bindParam(MYSQL_BIND *bind, enum_field_types type, const void *buf, unsigned long len) {
+	memset(bind, 0, sizeof(*bind));
+	bind->buffer_type = type;
+	bind->buffer = const_cast<void *>(buf);
+	bind->buffer_length = len;
+}
+
+MysqlCache::MysqlCache() {
+	conn = NULL;
+	last_used = 0;
+	batch_seq = 0;
+	for (int i = 0; i < STMT_COUNT; i++)
+		stmts[i] = NULL;
+}
+
+MysqlCache::~MysqlCache() {
+	cleanup();
+}
+
+int MysqlCache::init(const InfernoConf& conf) {
+	my_bool _recnct = 1;
+
+	cleanup();
+
+	if (DbCache::init(conf))
+		return -1;
+
+	// initialize libmysql
+	conn = mysql_init(NULL);
+	if (!conn)
+		return -1;
+
+	// enable automatic reconnection
+	mysql_options(conn, MYSQL_OPT_RECONNECT, (void *)&_recnct);
+	mysql_connected = false;
+	return 0;
+}
+
+void MysqlCache::setInfernoConf(const InfernoConf& conf) {
+	/* statements name the table they were prepared for */
+	if (conf.getTable() != dbConf.getTable())
+		closeStatements();
+	DbCache::setInfernoConf(conf);
+}
+
+/**
+ * Returns the name of the table holding the entries in progress.
+ */
+string MysqlCache::jobTable() const {
+	return dbConf.getTable() + "_jobs";
+}
+
+/**
+ * Makes sure the connection is usable. The server is only pinged once the
+ * connection has been idle for a while, or after a client-side error (such
+ * as a lost connection), so that a healthy connection in use costs no
+ * extra round trip per query.
+ */
+int MysqlCache::reconnect(int times) {
+	unsigned long tid;
+	time_t now = time(NULL);
+
+	if (mysql_connected) {
+		if (now - last_used < IDLE_CHECK && mysql_errno(conn) < CR_MIN_ERROR) {
+			last_used = now;
+			return 1;
+		}
+
+		tid = mysql_thread_id(conn);
+		if (!mysql_ping(conn)) {
+			/* an automatic reconnection loses prepared statements */
+			if (tid != mysql_thread_id(conn))
+				closeStatements();
+			last_used = now;
+			return 1;
+		}
+	}
+
+	/* try to establish connection 'times' times */
+	for(int i = 0; i < times; i++) {
+		if(connect()) {
+			last_used = now;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int MysqlCache::getErrorCode() {
+	return mysql_errno(this->conn);
+}
+
+char *MysqlCache::getErrorString() {
+	return const_cast<char*>(mysql_error(this->conn));
+}
+
+int MysqlCache::connect() {
+	closeStatements();
+	mysql_connected = (mysql_real_connect(conn,
+				dbConf.getHostname().c_str(),
+				dbConf.getUsername().c_str(),
+				dbConf.getPassword().c_str(),
+				dbConf.getStore().c_str(),
+				0, NULL, CLIENT_REMEMBER_OPTIONS) != NULL);
+	return mysql_connected;
+}
+
+/**
+ * Returns the SQL text of a hot-path statement.
+ */
+string MysqlCache::statementText(Statement id) {
+	const string& table = dbConf.getTable();
+	string jobs = jobTable();
+	stringstream stmt, standing;
+
+	/* verdicts that stand: classifications, and failures still backed off */
+	standing << "(status+0=" << InfernoConf::STATUS_DONE << " OR (status+0=" << InfernoConf::STATUS_FAILURE <<
+		" AND retry_after > NOW()))";
+
+	switch (id) {
+		case STMT_CLAIM:
+			/* a verdict that stands leaves nothing to claim, in the same round trip */
+			stmt << "INSERT INTO " << jobs << "(hash, url, decision, status) SELECT ?, LEFT(?, 2048), " <<
+				InfernoConf::CLASS_UNDEFINED << ", " << InfernoConf::STATUS_FETCHING << " FROM DUAL WHERE NOT EXISTS " <<
+				"(SELECT 1 FROM " << table << " WHERE hash=? AND " << standing.str() << ")";
+			break;
+		case STMT_RELEASE:
+			stmt << "DELETE FROM " << jobs << " WHERE hash=?";
+			break;
+		case STMT_GET_VERDICT:
+			stmt << "SELECT status+0 FROM " << table << " WHERE hash=? AND " << standing.str();
+			break;
+		case STMT_SET_STATUS:
+			stmt << "UPDATE " << jobs << " SET status=?, decision=IFNULL(?, decision), ctype=IFNULL(?, ctype) WHERE hash=?";
+			break;
+		case STMT_FIX_DECISION:
+			stmt << "UPDATE " << table << " SET decision=? WHERE hash=?";
+			break;
+		case STMT_FIX_CTYPE:
+			stmt << "UPDATE " << table << " SET ctype=? WHERE hash=?";
+			break;
+		case STMT_FINISH:
+			stmt << "INSERT INTO " << table << "(hash, url, decision, ctype, status, failures, reason, retry_after) " <<
+				"SELECT hash, url, IFNULL(?, decision), IFNULL(?, ctype), ?, 0, '', NULL FROM " << jobs << " WHERE hash=? " <<
+				"ON DUPLICATE KEY UPDATE url=VALUES(url), decision=VALUES(decision), ctype=VALUES(ctype), " <<
+				"status=VALUES(status), failures=0, reason='', retry_after=NULL";
+			break;
+		case STMT_GET_RECORD:
+			/* an entry in progress shadows an earlier verdict on it */
+			stmt << "SELECT status, decision, ctype, 0, UNIX_TIMESTAMP(modified), 0, 0 AS src FROM " << jobs <<
+				" WHERE hash=? UNION ALL " <<
+				"SELECT status+0, decision+0, ctype, failures, UNIX_TIMESTAMP(modified), " <<
+				"IFNULL(UNIX_TIMESTAMP(retry_after), 0), 1 FROM " << table << " WHERE hash=? AND status+0 IN (" <<
+				InfernoConf::STATUS_DONE << ", " << InfernoConf::STATUS_FAILURE << ") ORDER BY src LIMIT 1";
+			break;
+		default:
+			break;
+	}
+	return stmt.str();
+}
+
+/**
+ * Returns the prepared statement for the given id, preparing it on the
+ * current connection if needed, or NULL on error.
+ */
+MYSQL_STMT* MysqlCache::prepare(Statement id) {
+	MYSQL_STMT *stmt;
+	string text;
+
+	if (stmts[id])
+		return stmts[id];
+
+	text = statementText(id);
+	if (!(stmt = mysql_stmt_init(conn)))
+		return NULL;
+
+	if (mysql_stmt_prepare(stmt, text.c_str(), text.length())) {
+		Logger::debug("prepare(): mysql_stmt_prepare() failed. Error report: %s", mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+	return (stmts[id] = stmt);
+}
+
+/**
+ * Executes a hot-path statement with the given parameters. A statement
+ * lost along with its connection is prepared anew and executed once more.
+ *
+ * Returns: the executed statement, or NULL on error (with the error code
+ * stored in 'error', if given)
+ */
+MYSQL_STMT* MysqlCache::execute(Statement id, MYSQL_BIND *params, unsigned int *error) {
+	MYSQL_STMT *stmt;
+	unsigned int err = 0;
+
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (!(stmt = prepare(id)))
+			break;
+
+		if (!mysql_stmt_bind_param(stmt, params) && !mysql_stmt_execute(stmt))
+			return stmt;
+
+		err = mysql_stmt_errno(stmt);
+		if (err < CR_MIN_ERROR && err != ER_UNKNOWN_STMT_HANDLER && err != ER_NEED_REPREPARE)
+			break;
+
+		/* force a ping, reconnecting if needed */
+		closeStatements();
+		last_used = 0;
+		if (!reconnect())
+			break;
+	}
+
+	if (error)
+		*error = err;
+	return NULL;
+}
+
+void MysqlCache::closeStatements() {
+	for (int i = 0; i < STMT_COUNT; i++) {
+		if (stmts[i])
+			mysql_stmt_close(stmts[i]);
+		stmts[i] = NULL;
+	}
+}
+
+/**
+ * Tells whether an entry has a verdict that stands: either a classification
+ * or a failure whose back-off period has not yet elapsed.
+ *
+ * Returns: 1 if it has, 0 if it has not, -1 on error
+ */
+int MysqlCache::hasVerdict(const unsigned char *key) {
+	MYSQL_BIND params[1], result[1];
+	MYSQL_STMT *stmt;
+	int status, ret;
+
+	bindParam(&params[0], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+	if (!(stmt = execute(STMT_GET_VERDICT, params)))
+		return -1;
+
+	bindParam(&result[0], MYSQL_TYPE_LONG, &status, sizeof(status));
+	if (mysql_stmt_bind_result(stmt, result))
+		ret = -1;
+	else
+		ret = !mysql_stmt_fetch(stmt);
+	mysql_stmt_free_result(stmt);
+	return ret;
+}
+
+/**
+ * Drops the in-progress entry of the given key.
+ *
+ * Returns: 1 if there was one, 0 otherwise
+ */
+int MysqlCache::releaseUrlEntry(const unsigned char *key) {
+	MYSQL_BIND params[1];
+	MYSQL_STMT *stmt;
+
+	bindParam(&params[0], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+	if (!(stmt = execute(STMT_RELEASE, params)))
+		return 0;
+
+	return (mysql_stmt_affected_rows(stmt) == 1);
+}
+
+/**
+ * Claims an entry for fetching, unless it has a verdict already. The claim
+ * is an in-progress entry, which only one caller can create. Failed entries
+ * whose back-off period has elapsed are claimed anew. Hits and misses both
+ * take a single statement.
+ *
+ * Returns: 1 for success, -1 for 'dup_unique', 0 otherwise
+ */
+int MysqlCache::insertUrlEntry(const string& url, string& hash) {
+	unsigned char key[HASH_BYTES];
+	MYSQL_BIND params[3];
+	MYSQL_STMT *stmt;
+	unsigned int error = 0;
+
+	if (url.empty())
+		return 0;
+
+	if(!reconnect())
+		return 0;
+
+	if ((hash = hashUrl(url)).empty() || !hashBytes(hash, key))
+		return 0;
+
+	bindParam(&params[0], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+	bindParam(&params[1], MYSQL_TYPE_STRING, url.data(), url.length());
+	bindParam(&params[2], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+
+	if (!(stmt = execute(STMT_CLAIM, params, &error))) {
+		if (error == ER_DUP_UNIQUE || error == ER_DUP_ENTRY)
+			return -1;
+		return 0;
+	}
+	/* no row is inserted for an entry with a verdict */
+	return (mysql_stmt_affected_rows(stmt) == 1) ? 1 : -1;
+}
+
+/**
+ * Claims the entries of a batch of URLs at once, like insertUrlEntry()
+ * does. Each batch is tagged with a token unique among the live
+ * connections, so that a single lookup afterwards tells the entries
+ * claimed by the caller from those that already existed.
+ *
+ * Fills in the hash of each URL, and its outcome as insertUrlEntry() would
+ * return it: 1 if the caller is to fetch it, -1 if some other party is or
+ * has, 0 on error.
+ *
+ * Returns: the number of entries claimed, or -1 on error
+ */
+int MysqlCache::insertUrlEntries(const vector<string>& urls, vector<string>& hashes, vector<int>& results) {
+	string jobs = jobTable();
+	map<string, size_t> index;
+	int claimed = 0;
+
+	hashes.assign(urls.size(), "");
+	results.assign(urls.size(), 0);
+
+	if (urls.empty())
+		return 0;
+
+	if (!reconnect())
+		return -1;
+
+	for (size_t i = 0; i < urls.size(); i++) {
+		hashes[i] = hashUrl(urls[i]);
+		index[hashes[i]] = i;
+	}
+
+	for (size_t from = 0; from < urls.size(); from += BATCH_ROWS) {
+		size_t to = (from + BATCH_ROWS < urls.size()) ? from + BATCH_ROWS : urls.size();
+		unsigned long long token = ((unsigned long long)mysql_thread_id(conn) << 32) | (++batch_seq & 0xffffffffUL);
+		vector<string> wanted;
+		stringstream stmt;
+		MYSQL_RES *res;
+		MYSQL_ROW row;
+
+		/* entries with a verdict already are not claimed at all */
+		stmt << "SELECT LOWER(HEX(hash)) FROM " << dbConf.getTable() << " WHERE hash IN (" << keyList(hashes, from, to) <<
+			") AND (status+0=" << InfernoConf::STATUS_DONE << " OR (status+0=" << InfernoConf::STATUS_FAILURE <<
+			" AND retry_after > NOW()))";
+		if (mysql_query(conn, stmt.str().c_str()) || !(res = mysql_store_result(conn))) {
+			Logger::debug("insertUrlEntries(): mysql_query() failed. Error report: %s", mysql_error(conn));
+			continue;
+		}
+		while ((row = mysql_fetch_row(res))) {
+			map<string, size_t>::iterator it = index.find(row[0]);
+
+			if (it != index.end())
+				results[it->second] = -1;
+		}
+		mysql_free_result(res);
+
+		for (size_t i = from; i < to; i++)
+			if (!results[i])
+				wanted.push_back(hashes[i]);
+		if (wanted.empty())
+			continue;
+
+		stmt.str("");
+		stmt << "INSERT INTO " << jobs << "(hash, url, decision, status, ins_token) VALUES ";
+		for (size_t i = from, n = 0; i < to; i++) {
+			if (results[i])
+				continue;
+
+			char *buf = new char[2 * urls[i].length() + 1];
+
+			mysql_real_escape_string(conn, buf, urls[i].c_str(), urls[i].length());
+			stmt << ((n++) ? ", (" : "(") << hashKey(hashes[i]) << ", LEFT('" << buf << "', 2048), " <<
+				InfernoConf::CLASS_UNDEFINED << ", " << InfernoConf::STATUS_FETCHING << ", " << token << ")";
+			delete[] buf;
+		}
+		stmt << " ON DUPLICATE KEY UPDATE ins_token=ins_token";
+
+		/* the jobs table is not transactional; a failed INSERT may have claimed some rows */
+		if (mysql_query(conn, stmt.str().c_str())) {
+			Logger::debug("insertUrlEntries(): mysql_query() failed. Error report: %s", mysql_error(conn));
+			releaseBatch(token, wanted);
+			continue;
+		}
+
+		stmt.str("");
+		stmt << "SELECT LOWER(HEX(hash)), ins_token FROM " << jobs << " WHERE hash IN (" << keyList(wanted, 0, wanted.size()) << ")";
+		if (mysql_query(conn, stmt.str().c_str()) || !(res = mysql_store_result(conn))) {
+			Logger::debug("insertUrlEntries(): mysql_query() failed. Error report: %s", mysql_error(conn));
+			releaseBatch(token, wanted);
+			continue;
+		}
+
+		while ((row = mysql_fetch_row(res))) {
+			map<string, size_t>::iterator it = index.find(row[0]);
+
+			if (it != index.end())
+				results[it->second] = (strtoull(row[1], NULL, 10) == token) ? 1 : -1;
+		}
+		mysql_free_result(res);
+	}
+
+	for (size_t i = 0; i < results.size(); i++)
+		claimed += (results[i] == 1);
+	return claimed;
+}
+
+/**
+ * Drops the entries claimed by a batch whose outcome is unknown, so that
+ * neither they nor their waiters are left hanging, and wakes the waiters
+ * to claim them anew.
+ */
+void MysqlCache::releaseBatch(unsigned long long token, const vector<string>& hashes) {
+	stringstream stmt;
+
+	/* the failure may have been a lost connection; try once more over a new one */
+	stmt << "DELETE FROM " << jobTable() << " WHERE ins_token=" << token;
+	if (mysql_query(conn, stmt.str().c_str())) {
+		last_used = 0;
+		if (!reconnect() || mysql_query(conn, stmt.str().c_str()))
+			Logger::error("insertUrlEntries(): failed to release the claims of batch %llu. Error report: %s", token, mysql_error(conn));
+	}
+
+	for (size_t i = 0; i < hashes.size(); i++)
+		VerdictBus::publish(dbConf, hashes[i]);
+}
+
+/**
+ * Returns the comma-separated keys of hashes [from, to), for use in an
+ * IN() clause.
+ */
+string MysqlCache::keyList(const vector<string>& hashes, size_t from, size_t to) {
+	string list;
+
+	for (size_t i = from; i < to; i++) {
+		if (i > from)
+			list.push_back(',');
+		list.append(hashKey(hashes[i]));
+	}
+	return list;
+}
+
+/**
+ * Returns the SQL literal of the (binary) key stored for the given hash.
+ */
+string MysqlCache::hashKey(const string& hash) {
+	return "x'" + hash + "'";
+}
+
+/**
+ * Looks up the whole state of an entry in a single query: the entry in
+ * progress, if any, or else its verdict.
+ *
+ * Returns: 1 if the entry was found, 0 otherwise (with the status of the
+ * record set to 'STATUS_ERROR')
+ */
+int MysqlCache::lookupUrlRecord(const string& hash, UrlRecord& record) {
+	unsigned char key[HASH_BYTES];
+	MYSQL_BIND params[2], result[7];
+	MYSQL_STMT *stmt;
+	int status, decision, src;
+	long long modified, retry_after;
+	char buf[256];
+	unsigned long len = 0;
+	int ret = 0;
+
+	record.status = InfernoConf::STATUS_ERROR;
+	record.decision = InfernoConf::CLASS_ERROR;
+	record.ctype.clear();
+	record.failures = 0;
+	record.modified = record.retry_after = 0;
+
+	// attempt reconnection if connection to mysql has gone down
+	if(!reconnect()) {
+		Logger::debug("lookupUrlRecord: connection was turned down...");
+		return 0;
+	}
+
+	if (!hashBytes(hash, key))
+		return 0;
+	bindParam(&params[0], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+	bindParam(&params[1], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+
+	if (!(stmt = execute(STMT_GET_RECORD, params)))
+		return 0;
+
+	bindParam(&result[0], MYSQL_TYPE_LONG, &status, sizeof(status));
+	bindParam(&result[1], MYSQL_TYPE_LONG, &decision, sizeof(decision));
+	bindParam(&result[2], MYSQL_TYPE_STRING, buf, sizeof(buf));
+	result[2].length = &len;
+	bindParam(&result[3], MYSQL_TYPE_LONG, &record.failures, sizeof(record.failures));
+	result[3].is_unsigned = 1;
+	bindParam(&result[4], MYSQL_TYPE_LONGLONG, &modified, sizeof(modified));
+	bindParam(&result[5], MYSQL_TYPE_LONGLONG, &retry_after, sizeof(retry_after));
+	bindParam(&result[6], MYSQL_TYPE_LONG, &src, sizeof(src));
+
+	if (!mysql_stmt_bind_result(stmt, result)) {
+		int fetched = mysql_stmt_fetch(stmt);
+
+		if (fetched == MYSQL_DATA_TRUNCATED && len > sizeof(buf)) {
+			/* unusually long content type; fetch it whole */
+			char *big = new char[len];
+
+			bindParam(&result[2], MYSQL_TYPE_STRING, big, len);
+			result[2].length = &len;
+			if (!mysql_stmt_fetch_column(stmt, &result[2], 2, 0)) {
+				record.ctype.assign(big, len);
+				fetched = 0;
+			}
+			delete[] big;
+		} else if (!fetched) {
+			record.ctype.assign(buf, len);
+		}
+
+		if (!fetched) {
+			record.status = (InfernoConf::Status)status;
+			record.decision = (InfernoConf::Classification)decision;
+			record.modified = (time_t)modified;
+			record.retry_after = (time_t)retry_after;
+			ret = 1;
+		} else {
+			record.failures = 0;
+		}
+	}
+	mysql_stmt_free_result(stmt);
+
+	return ret;
+}
+
+/**
+ * Looks up the state of a set of entries, in as few queries as the batch
+ * size allows. Entries not found are left out of the result.
+ *
+ * Returns: the number of entries found, or -1 on error
+ */
+int MysqlCache::lookupUrlRecords(const set<string>& hashes, map<string, UrlRecord>& records) {
+	vector<string> keys(hashes.begin(), hashes.end());
+
+	records.clear();
+	if (keys.empty())
+		return 0;
+
+	if (!reconnect())
+		return -1;
+
+	for (size_t from = 0; from < keys.size(); from += BATCH_ROWS) {
+		size_t to = (from + BATCH_ROWS < keys.size()) ? from + BATCH_ROWS : keys.size();
+		string list = keyList(keys, from, to);
+		stringstream stmt;
+		MYSQL_RES *res;
+		MYSQL_ROW row;
+
+		/* verdicts come first, so that entries in progress replace them */
+		stmt << "SELECT LOWER(HEX(hash)), status+0, decision+0, ctype, failures, UNIX_TIMESTAMP(modified), " <<
+			"IFNULL(UNIX_TIMESTAMP(retry_after), 0), 1 AS src FROM " << dbConf.getTable() <<
+			" WHERE hash IN (" << list << ") AND status+0 IN (" << InfernoConf::STATUS_DONE << ", " <<
+			InfernoConf::STATUS_FAILURE << ") UNION ALL " <<
+			"SELECT LOWER(HEX(hash)), status, decision, ctype, 0, UNIX_TIMESTAMP(modified), 0, 0 FROM " <<
+			jobTable() << " WHERE hash IN (" << list << ") ORDER BY src DESC";
+
+		if (mysql_query(conn, stmt.str().c_str()) || !(res = mysql_store_result(conn))) {
+			Logger::debug("lookupUrlRecords(): mysql_query() failed. Error report: %s", mysql_error(conn));
+			return -1;
+		}
+
+		while ((row = mysql_fetch_row(res))) {
+			UrlRecord& record = records[row[0]];
+
+			record.status = (InfernoConf::Status)atoi(row[1]);
+			record.decision = (InfernoConf::Classification)atoi(row[2]);
+			record.ctype = row[3];
+			record.failures = strtoul(row[4], NULL, 10);
+			record.modified = (time_t)strtoll(row[5], NULL, 10);
+			record.retry_after = (time_t)strtoll(row[6], NULL, 10);
+		}
+		mysql_free_result(res);
+	}
+
+	return (int)records.size();
+}
+
+/**
+ * Runs an update statement taking an integer and the hash of an entry.
+ *
+ * Returns: 1 if the entry was changed, 0 otherwise
+ */
+int MysqlCache::updateField(Statement id, const string& hash, int value) {
+	unsigned char key[HASH_BYTES];
+	MYSQL_BIND params[2];
+	MYSQL_STMT *stmt;
+
+	if (!hashBytes(hash, key))
+		return 0;
+	bindParam(&params[0], MYSQL_TYPE_LONG, &value, sizeof(value));
+	bindParam(&params[1], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+
+	if (!(stmt = execute(id, params)))
+		return 0;
+
+	/* check if we have a row change */
+	return (mysql_stmt_affected_rows(stmt) == 1);
+}
+
+/**
+ * Runs an update statement taking a string and the hash of an entry.
+ *
+ * Returns: 1 if the entry was changed, 0 otherwise
+ */
+int MysqlCache::updateText(Statement id, const string& hash, const string& value) {
+	unsigned char key[HASH_BYTES];
+	MYSQL_BIND params[2];
+	MYSQL_STMT *stmt;
+
+	if (!hashBytes(hash, key))
+		return 0;
+	bindParam(&params[0], MYSQL_TYPE_STRING, value.data(), value.length());
+	bindParam(&params[1], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+
+	if (!(stmt = execute(id, params)))
+		return 0;
+
+	/* check if we have a row change */
+	return (mysql_stmt_affected_rows(stmt) == 1);
+}
+
+/**
+ * Tells whether other parties act upon an entry reaching the given
+ * status, so that it must be written at once.
+ */
+bool MysqlCache::awaited(InfernoConf::Status status) {
+	switch (status) {
+		case InfernoConf::STATUS_PROCESSING:
+		case InfernoConf::STATUS_FETCHING_MORE:
+			return false;
+		default:
+			/* classifying entries get no early verdict (see sead) */
+			return true;
+	}
+}
+
+/**
+ * Binds the decision and content type of a queued change, or NULL for
+ * those left unchanged.
+ */
+void MysqlCache::bindChange(MYSQL_BIND *params, const WriteBehind::Change& change) {
+	if (change.decision >= 0)
+		bindParam(&params[0], MYSQL_TYPE_LONG, &change.decision, sizeof(change.decision));
+	else
+		bindParam(&params[0], MYSQL_TYPE_NULL, NULL, 0);
+
+	if (change.has_ctype)
+		bindParam(&params[1], MYSQL_TYPE_STRING, change.ctype.data(), change.ctype.length());
+	else
+		bindParam(&params[1], MYSQL_TYPE_NULL, NULL, 0);
+}
+
+/**
+ * Writes a batch of queued changes, in as few statements as the batch size
+ * allows. Changes to entries no longer in progress are dropped.
+ *
+ * Returns: the number of entries changed, or -1 on error
+ */
+int MysqlCache::applyChanges(const map<string, WriteBehind::Change>& changes) {
+	vector<string> keys;
+	int changed = 0;
+
+	if (changes.empty())
+		return 0;
+
+	if (!reconnect())
+		return -1;
+
+	for (map<string, WriteBehind::Change>::const_iterator it = changes.begin(); it != changes.end(); it++)
+		keys.push_back(it->first);
+
+	for (size_t from = 0; from < keys.size(); from += BATCH_ROWS) {
+		size_t to = (from + BATCH_ROWS < keys.size()) ? from + BATCH_ROWS : keys.size();
+		stringstream stmt, status, decision, ctype;
+
+		for (size_t i = from; i < to; i++) {
+			const WriteBehind::Change& change = changes.find(keys[i])->second;
+
+			if (change.status >= 0)
+				status << " WHEN " << hashKey(keys[i]) << " THEN " << change.status;
+			if (change.decision >= 0)
+				decision << " WHEN " << hashKey(keys[i]) << " THEN " << change.decision;
+			if (change.has_ctype) {
+				char *buf = new char[2 * change.ctype.length() + 1];
+
+				mysql_real_escape_string(conn, buf, change.ctype.c_str(), change.ctype.length());
+				ctype << " WHEN " << hashKey(keys[i]) << " THEN '" << buf << "'";
+				delete[] buf;
+			}
+		}
+
+		stmt << "UPDATE " << jobTable() << " SET modified=NOW()";
+		if (!status.str().empty())
+			stmt << ", status=CASE hash" << status.str() << " ELSE status END";
+		if (!decision.str().empty())
+			stmt << ", decision=CASE hash" << decision.str() << " ELSE decision END";
+		if (!ctype.str().empty())
+			stmt << ", ctype=CASE hash" << ctype.str() << " ELSE ctype END";
+		stmt << " WHERE hash IN (" << keyList(keys, from, to) << ")";
+
+		if (mysql_query(conn, stmt.str().c_str())) {
+			Logger::debug("applyChanges(): mysql_query() failed. Error report: %s", mysql_error(conn));
+			return -1;
+		}
+		changed += (int)mysql_affected_rows(conn);
+	}
+
+	return changed;
+}
+
+/**
+ * Queues the classification of an entry in progress, to be written along
+ * with its final status.
+ */
+int MysqlCache::updateUrlClassification(const string& hash, InfernoConf::Classification classification) {
+	WriteBehind::Change change;
+
+	change.decision = classification;
+	WriteBehind::defer(dbConf, hash, change);
+	return 1;
+}
+
+/**
+ * Advances an entry in progress. Intermediate states nobody waits on are
+ * queued; the rest are written at once, along with the changes queued for
+ * the entry. Final states turn it into a verdict, written to the verdict
+ * table in a single statement.
+ */
+int MysqlCache::updateUrlStatus(const string& hash, InfernoConf::Status status) {
+	unsigned char key[HASH_BYTES];
+	WriteBehind::Change change;
+	MYSQL_BIND params[4];
+	MYSQL_STMT *stmt;
+	int value = status;
+
+	if (status == InfernoConf::STATUS_FAILURE)
+		return updateUrlFailure(hash, "unspecified failure");
+
+	if (!awaited(status)) {
+		change.status = status;
+		WriteBehind::defer(dbConf, hash, change);
+		return 1;
+	}
+
+	if(!reconnect() || !hashBytes(hash, key))
+		return 0;
+
+	change = WriteBehind::take(hash);
+	if (status != InfernoConf::STATUS_DONE) {
+		bindParam(&params[0], MYSQL_TYPE_LONG, &value, sizeof(value));
+		bindChange(&params[1], change);
+		bindParam(&params[3], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+		if (!(stmt = execute(STMT_SET_STATUS, params)))
+			return 0;
+		/* check if we have a row change */
+		return (mysql_stmt_affected_rows(stmt) == 1);
+	}
+
+	bindChange(&params[0], change);
+	bindParam(&params[2], MYSQL_TYPE_LONG, &value, sizeof(value));
+	bindParam(&params[3], MYSQL_TYPE_BLOB, key, HASH_BYTES);
+	if (!(stmt = execute(STMT_FINISH, params)))
+		return 0;
+
+	/* 1 for a new verdict, 2 for a replaced one, 0 for none or one
+	 * identical to it */
+	if (mysql_stmt_affected_rows(stmt) == 0) {
+		/* finished already, by an early verdict; amend it */
+		if (hasVerdict(key) != 1)
+			return 0;
+		if (change.decision >= 0)
+			updateField(STMT_FIX_DECISION, hash, change.decision);
+		if (change.has_ctype)
+			updateText(STMT_FIX_CTYPE, hash, change.ctype);
+	}
+
+	/* the verdict stands; the entry in progress must not shadow it */
+	releaseUrlEntry(key);
+	VerdictBus::publish(dbConf, hash);
+	return 1;
+}
+
+/**
+ * Marks an entry as failed, recording the reason and scheduling the next
+ * attempt. The back-off period doubles with every consecutive failure,
+ * bounded by the configured maximum. With back-off disabled, the entry is
+ * removed altogether so that the next request re-fetches it.
+ */
+int MysqlCache::updateUrlFailure(const string& hash, const string& reason) {
+	const string& table = dbConf.getTable();
+	unsigned char key[HASH_BYTES];
+	stringstream stmt, backoff;
+	string why = reason.substr(0, 255);
+	my_ulonglong changed;
+	char *buf;
+
+	if(!reconnect() || !hashBytes(hash, key))
+		return 0;
+
+	/* nothing queued for the entry matters any more */
+	WriteBehind::take(hash);
+
+	if (dbConf.getFailureBackoff() <= 0) {
+		stmt << "DELETE FROM " << table << " WHERE hash=" << hashKey(hash);
+		if (mysql_query(conn, stmt.str().c_str())) {
+			Logger::debug("updateUrlFailure(): mysql_query() failed. Error report: %s", mysql_error(conn));
+			return 0;
+		}
+		changed = mysql_affected_rows(conn);
+		changed += releaseUrlEntry(key);
+		VerdictBus::publish(dbConf, hash);
+		return (changed > 0);
+	}
+
+	if (!(buf = new char[2 * why.length() + 1]))
+		return 0;
+	mysql_real_escape_string(conn, buf, why.c_str(), why.length());
+
+	/* MySQL evaluates the assignments left to right, so 'failures'
+	 * already holds the incremented count in the back-off period */
+	backoff << "NOW() + INTERVAL LEAST(" << dbConf.getFailureBackoff() <<
+		" * POW(2, LEAST(failures - 1, 30)), " << dbConf.getFailureBackoffMax() << ") SECOND";
+	stmt << "INSERT INTO " << table << "(hash, url, decision, ctype, status, failures, reason, retry_after) " <<
+		"SELECT hash, url, decision, ctype, " << InfernoConf::STATUS_FAILURE << ", 1, '" << buf << "', " <<
+		"NOW() + INTERVAL LEAST(" << dbConf.getFailureBackoff() << ", " << dbConf.getFailureBackoffMax() << ") SECOND" <<
+		" FROM " << jobTable() << " WHERE hash=" << hashKey(hash) <<
+		" ON DUPLICATE KEY UPDATE status=" << InfernoConf::STATUS_FAILURE <<
+		", failures=failures+1, reason=VALUES(reason), retry_after=" << backoff.str();
+
+	if (mysql_query(conn, stmt.str().c_str())) {
+		Logger::debug("updateUrlFailure(): mysql_query() failed. Error report: %s", mysql_error(conn));
+		delete[] buf;
+		return 0;
+	}
+
+	if ((changed = mysql_affected_rows(conn)) == 0) {
+		/* not in progress; fail the verdict itself */
+		stmt.str("");
+		stmt << "UPDATE " << table << " SET status=" << InfernoConf::STATUS_FAILURE <<
+			", failures=failures+1, reason='" << buf << "', retry_after=" << backoff.str() <<
+			" WHERE hash=" << hashKey(hash);
+		if (mysql_query(conn, stmt.str().c_str()))
+			Logger::debug("updateUrlFailure(): mysql_query() failed. Error report: %s", mysql_error(conn));
+		else
+			changed = mysql_affected_rows(conn);
+	}
+	delete[] buf;
+
+	releaseUrlEntry(key);
+	VerdictBus::publish(dbConf, hash);
+	return (changed > 0);
+}
+
+/**
+ * Removes an entry whose fetch was abandoned before completion, so that
+ * the next request for it fetches it anew. Verdicts are kept.
+ *
+ * Returns: 1 if the entry was removed, 0 otherwise
+ */
+int MysqlCache::removeUrlEntry(const string& hash) {
+	unsigned char key[HASH_BYTES];
+
+	if(!reconnect() || !hashBytes(hash, key))
+		return 0;
+
+	WriteBehind::take(hash);
+	if (!releaseUrlEntry(key))
+		return 0;
+
+	/* its waiters are to claim it anew */
+	VerdictBus::publish(dbConf, hash);
+	return 1;
+}
+
+/**
+ * Marks the verdict on an entry as changed now, so that it is kept for
+ * another retention period. Entries in progress are left alone.
+ *
+ * Returns: 1 if the verdict was renewed, 0 otherwise
+ */
+int MysqlCache::renewUrlVerdict(const string& hash) {
+	unsigned char key[HASH_BYTES];
+	stringstream stmt;
+
+	/* the hash is checked to be hexadecimal before it is put in the query */
+	if (!reconnect() || !hashBytes(hash, key))
+		return 0;
+
+	stmt << "UPDATE " << dbConf.getTable() << " SET modified=NOW() WHERE hash=UNHEX('" << hash << "') AND status+0=" <<
+		InfernoConf::STATUS_DONE;
+	if (mysql_query(conn, stmt.str().c_str())) {
+		Logger::debug("renewUrlVerdict(): mysql_query() failed. Error report: %s", mysql_error(conn));
+		return 0;
+	}
+	return (mysql_affected_rows(conn) == 1);
+}
+
+/**
+ * Queues the content type of an entry in progress, to be written along
+ * with its next awaited status.
+ */
+int MysqlCache::updateUrlContentType(const string& hash, const string& ctype) {
+	WriteBehind::Change change;
+
+	/* the column holds at most MAX_CTYPE characters */
+	change.has_ctype = true;
+	change.ctype = ctype.substr(0, MAX_CTYPE);
+	WriteBehind::defer(dbConf, hash, change);
+	return 1;
+}
+
+void MysqlCache::cleanup() {
+	closeStatements();
+	if (conn)
+		mysql_close(conn);
+	conn = NULL;
+}
+
+/**
+ * Drops the entries left in progress, along with any such entries kept in
+ * the verdict table by earlier versions.
+ */
+int MysqlCache::fixCache() {
+	stringstream stmt;
+
+	if (!reconnect())
+		return 0;
+
+	stmt << "DELETE FROM " << jobTable();
+	if (mysql_query(conn, stmt.str().c_str()))
+		return 0;
+
+	/* status+0 is the status number for both ENUM and integer columns */
+	stmt.str("");
+	stmt << "DELETE FROM " << dbConf.getTable() << " WHERE status+0 NOT IN (" <<
+		InfernoConf::STATUS_DONE << ", " << InfernoConf::STATUS_FAILURE << ")";
+	if (mysql_query(conn, stmt.str().c_str()))
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Removes up to 'limit' verdicts last changed more than 'age' seconds ago
+ * (found through the index on the modified column); 'more' tells whether
+ * there may be others left.
+ *
+ * Returns: the number of verdicts removed, or -1 on error
+ */
+int MysqlCache::expireUrlEntries(long age, size_t limit, bool& more) {
+	stringstream stmt;
+
+	more = false;
+	if (!reconnect())
+		return -1;
+
+	stmt << "DELETE FROM " << dbConf.getTable() << " WHERE modified < NOW() - INTERVAL " << age <<
+		" SECOND ORDER BY modified LIMIT " << limit;
+	if (mysql_query(conn, stmt.str().c_str())) {
+		Logger::debug("expireUrlEntries(): mysql_query() failed. Error report: %s", mysql_error(conn));
+		return -1;
+	}
+	more = (mysql_affected_rows(conn) == limit);
+	return (int)mysql_affected_rows(conn);
+}
+
+/**
+ * Lists up to 'limit' entries in progress last changed more than 'age'
+ * seconds ago.
+ *
+ * Returns: the number of entries listed, or -1 on error
+ */
+int MysqlCache::staleUrlEntries(long age, size_t limit, vector<string>& hashes) {
+	stringstream stmt;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+	hashes.clear();
+	if (!reconnect())
+		return -1;
+
+	stmt << "SELECT LOWER(HEX(hash)) FROM " << jobTable() << " WHERE modified < NOW() - INTERVAL " << age <<
+		" SECOND LIMIT " << limit;
+	if (mysql_query(conn, stmt.str().c_str()) || !(res = mysql_store_result(conn))) {
+		Logger::debug("staleUrlEntries(): mysql_query() failed. Error report: %s", mysql_error(conn));
+		return -1;
+	}
+
+	while ((row = mysql_fetch_row(res)))
+		hashes.push_back(row[0]);
+	mysql_free_result(res);
+
+	return (int)hashes.size();
+}
@@ -0,0 +1,191 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdlib>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prefetcher.h"
+#include "fetchstats.h"
+#include "multifetch.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const size_t Prefetcher::MAX_QUEUE = 256;
+const double Prefetcher::MAX_AGE = 120.0;
+const double Prefetcher::IDLE_LOAD = 0.5;
+const long Prefetcher::CONCURRENCY = 2;
+
+deque<Prefetcher::Job> Prefetcher::queue;
+set<string> Prefetcher::queued;
+InfernoConf Prefetcher::conf;
+long Prefetcher::live = 0;
+long Prefetcher::budget_used = 0;
+double Prefetcher::budget_start = 0;
+bool Prefetcher::started = false;
+pthread_mutex_t Prefetcher::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Prefetcher::wakeup = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Queues up to the configured number of links of a page served, starting
+ * the background crawler on first use. Called with live requests only.
+ */
+void Prefetcher::enqueue(const set<string>& links, const InfernoConf& iConf) {
+	long n = iConf.getPrefetchLinks();
+
+	if (n <= 0 || iConf.getPrefetchRate() <= 0)
+		return;
+
+	pthread_mutex_lock(&lock);
+	conf = iConf;
+
+	if (!started) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, run, NULL)) {
+			Logger::error("pthread_create");
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+		pthread_detach(tid);
+		started = true;
+	}
+
+	double now = FetchStats::now();
+	for (set<string>::const_iterator it = links.begin(); it != links.end() && n > 0; it++) {
+		if (!queued.insert(*it).second)
+			continue;
+		Job job;
+		job.url = *it;
+		job.queued = now;
+		queue.push_back(job);
+		n--;
+	}
+
+	// make room by dropping the links of the pages served longest ago
+	while (queue.size() > MAX_QUEUE) {
+		queued.erase(queue.front().url);
+		queue.pop_front();
+	}
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+}
+
+void Prefetcher::liveBegin() {
+	pthread_mutex_lock(&lock);
+	live++;
+	pthread_mutex_unlock(&lock);
+}
+
+void Prefetcher::liveEnd() {
+	pthread_mutex_lock(&lock);
+	live--;
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Tells whether a background crawl should give way to live requests.
+ */
+bool Prefetcher::preempted() {
+	bool ret;
+
+	pthread_mutex_lock(&lock);
+	ret = (live > 0);
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+/**
+ * Tells whether the proxy is idle: no live requests, no image transfers
+ * in flight and little CPU load. Called with the lock held.
+ */
+bool Prefetcher::idle() {
+	double load;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (live > 0 || FetchStats::getInflight() > 0)
+		return false;
+	if (getloadavg(&load, 1) == 1 && load > IDLE_LOAD * ((cpus > 0) ? cpus : 1))
+		return false;
+	return true;
+}
+
+void* Prefetcher::run(void *arg) {
+	(void)arg;
+
+#ifdef SYS_gettid
+	// lowest scheduling priority, for this thread only
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19))
+		Logger::debug("Failed to lower the priority of the crawl-ahead thread");
+#endif
+
+	pthread_mutex_lock(&lock);
+	while (true) {
+		double now = FetchStats::now();
+
+		// links of pages served long ago are unlikely to be followed now
+		while (!queue.empty() && now - queue.front().queued > MAX_AGE) {
+			queued.erase(queue.front().url);
+			queue.pop_front();
+		}
+
+		if (now - budget_start >= 60.0) {
+			budget_start = now;
+			budget_used = 0;
+		}
+
+		if (queue.empty() || budget_used >= conf.getPrefetchRate() || !idle()) {
+			struct timespec ts;
+			ts.tv_sec = (time_t)now + 1;
+			ts.tv_nsec = 0;
+			pthread_cond_timedwait(&wakeup, &lock, &ts);
+			continue;
+		}
+
+		// the links of the most recent page are the most likely to be followed
+		Job job = queue.back();
+		queue.pop_back();
+		queued.erase(job.url);
+		budget_used++;
+
+		InfernoConf iConf = conf;
+		pthread_mutex_unlock(&lock);
+
+		if (!iConf.getMaxXfers() || iConf.getMaxXfers() > CONCURRENCY)
+			iConf.setMaxXfers(CONCURRENCY);
+
+		Multifetch multifetch(iConf);
+		string hash, ctype;
+		multifetch.setBackground(true);
+
+		Logger::debug("Crawling ahead to %s", job.url.c_str());
+		if (multifetch.extractlinks(job.url, hash, ctype) == InfernoConf::CLASS_ERROR && preempted())
+			Logger::debug("Crawl-ahead of %s gave way to live requests", job.url.c_str());
+
+		pthread_mutex_lock(&lock);
+	}
+	return NULL;
+}
@@ -0,0 +1,277 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctime>
+#include <map>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "reaper.h"
+#include "dbpool.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const long Reaper::ROUND_INTERVAL = 60;
+const size_t Reaper::BATCH = 256;
+const long Reaper::GRACE = 600;
+
+InfernoConf Reaper::conf;
+int Reaper::started = 0;
+pthread_mutex_t Reaper::lock = PTHREAD_MUTEX_INITIALIZER;
+vector<DIR*> Reaper::sweep_dirs;
+vector<string> Reaper::sweep_paths;
+
+/**
+ * Starts the reaper on first use, unless disabled by the configuration.
+ *
+ * Returns: 0 on success, 1 on error
+ */
+int Reaper::init(const InfernoConf& iConf) {
+	int ret = 0;
+
+	// called for every request; only the first call takes the lock
+	if (iConf.getReapRate() <= 0 || __sync_fetch_and_add(&started, 0))
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	if (!started && iConf.getReapRate() > 0) {
+		pthread_t tid;
+		conf = iConf;
+		if (pthread_create(&tid, NULL, run, NULL)) {
+			Logger::error("pthread_create");
+			ret = 1;
+		} else {
+			pthread_detach(tid);
+			started = 1;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+/**
+ * Sleeps for as long as handling the given number of entries or files
+ * takes at the configured rate.
+ */
+void Reaper::pace(const InfernoConf& iConf, size_t handled) {
+	struct timespec ts;
+	long long nsecs = handled * 1000000000LL / iConf.getReapRate();
+
+	ts.tv_sec = nsecs / 1000000000LL;
+	ts.tv_nsec = nsecs % 1000000000LL;
+	while (nanosleep(&ts, &ts))
+		;
+}
+
+/**
+ * Removes verdicts past the retention period, a batch at a time, until a
+ * pass over them is complete.
+ *
+ * Returns: the number of verdicts removed
+ */
+int Reaper::expire(const InfernoConf& iConf) {
+	DbCache *cache;
+	bool more = true;
+	int n, total = 0;
+
+	if (iConf.getCacheRetention() <= 0)
+		return 0;
+
+	while (more) {
+		if (!(cache = DbPool::checkout(iConf)))
+			break;
+		n = cache->expireUrlEntries(iConf.getCacheRetention(), BATCH, more);
+		DbPool::checkin(cache);
+		if (n < 0)
+			break;
+		total += n;
+		pace(iConf, n);
+	}
+
+	return total;
+}
+
+/**
+ * Gives up the entries left in progress for longer than the grace period
+ * whose spool file is gone, so that they are fetched anew when next
+ * requested.
+ *
+ * Returns: the number of entries given up
+ */
+int Reaper::releaseStale(const InfernoConf& iConf) {
+	vector<string> hashes;
+	DbCache *cache;
+	struct stat st;
+	int released = 0;
+
+	if (!(cache = DbPool::checkout(iConf)))
+		return 0;
+
+	if (cache->staleUrlEntries(GRACE, BATCH, hashes) > 0) {
+		for (vector<string>::iterator it = hashes.begin(); it != hashes.end(); it++) {
+			if (!stat(iConf.computePathFromHash(*it).c_str(), &st) ||
+					!stat(iConf.computeLegacyPathFromHash(*it).c_str(), &st))
+				continue;
+			released += cache->removeUrlEntry(*it);
+		}
+	}
+	DbPool::checkin(cache);
+
+	if (!hashes.empty())
+		pace(iConf, hashes.size());
+	return released;
+}
+
+/**
+ * Removes the spool files without an entry, and the temporary ones
+ * (<hash>.<suffix>) of spool writers that died before publishing, reading
+ * the spool a batch of directory entries at a time, until 'budget' entries
+ * have been read or the pass over the spool is complete. The next call
+ * carries on from there, or starts a new pass.
+ *
+ * Returns: the number of files removed
+ */
+int Reaper::sweep(const InfernoConf& iConf, size_t budget) {
+	size_t seen = 0;
+	int removed = 0;
+	DIR *d;
+
+	if (sweep_dirs.empty()) {
+		if (!(d = opendir(iConf.getDirectory().c_str())))
+			return 0;
+		sweep_dirs.push_back(d);
+		sweep_paths.push_back(iConf.getDirectory());
+	}
+
+	while (!sweep_dirs.empty() && seen < budget) {
+		time_t before = time(NULL) - GRACE;
+		vector<string> hashes, paths;
+		size_t read = 0;
+
+		while (!sweep_dirs.empty() && read < BATCH && seen + read < budget) {
+			struct dirent *de;
+			struct stat st;
+
+			if (!(de = readdir(sweep_dirs.back()))) {
+				closedir(sweep_dirs.back());
+				sweep_dirs.pop_back();
+				sweep_paths.pop_back();
+				continue;
+			}
+			read++;
+
+			string name = de->d_name;
+			string path = sweep_paths.back() + "/" + name;
+
+			// dot files are ours
+			if (name[0] == '.' || lstat(path.c_str(), &st))
+				continue;
+
+			if (S_ISDIR(st.st_mode)) {
+				if (sweep_dirs.size() <= (size_t)InfernoConf::MAX_SPOOL_LEVELS && (d = opendir(path.c_str()))) {
+					sweep_dirs.push_back(d);
+					sweep_paths.push_back(path);
+				}
+				continue;
+			}
+			if (!S_ISREG(st.st_mode) || name.length() < 32 || name.find_first_not_of("0123456789abcdef") < 32 ||
+					st.st_mtime >= before)
+				continue;
+
+			// live writers publish well within the grace period
+			if (name.length() > 33 && name[32] == '.') {
+				if (!unlink(path.c_str()))
+					removed++;
+				continue;
+			}
+			if (name.length() != 32)
+				continue;
+
+			hashes.push_back(name);
+			paths.push_back(path);
+		}
+		seen += read;
+
+		if (!hashes.empty()) {
+			set<string> batch(hashes.begin(), hashes.end());
+			map<string, UrlRecord> records;
+			DbCache *cache;
+			int found;
+
+			if (!(cache = DbPool::checkout(iConf)))
+				break;
+			found = cache->lookupUrlRecords(batch, records);
+			DbPool::checkin(cache);
+			if (found < 0)
+				break;
+
+			for (size_t i = 0; i < hashes.size(); i++)
+				if (!records.count(hashes[i]) && !unlink(paths[i].c_str()))
+					removed++;
+		}
+		pace(iConf, read);
+	}
+
+	return removed;
+}
+
+void* Reaper::run(void *arg) {
+	InfernoConf iConf;
+	bool leader = false;
+	int fd = -1;
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	iConf = conf;
+	pthread_mutex_unlock(&lock);
+
+	string lockPath = iConf.getDirectory() + "/.reaper";
+
+	while (true) {
+		sleep(ROUND_INTERVAL);
+
+		// one process of the host reaps; the others stand by in case it exits
+		if (!leader) {
+			if (fd < 0 && (fd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0666)) < 0)
+				continue;
+			if (flock(fd, LOCK_EX | LOCK_NB))
+				continue;
+			leader = true;
+			Logger::info("Reaping cache of %s from process %d", iConf.getDirectory().c_str(), (int)getpid());
+		}
+
+		int expired = expire(iConf);
+		int released = releaseStale(iConf);
+		// as many spool entries as the rate allows for in a round
+		int removed = sweep(iConf, ROUND_INTERVAL * iConf.getReapRate());
+
+		if (expired || released || removed)
+			Logger::debug("Reaped %d expired verdicts, %d stale entries and %d orphaned spool files",
+					expired, released, removed);
+	}
+	return NULL;
+}
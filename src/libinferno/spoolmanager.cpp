@@ -0,0 +1,310 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "spoolmanager.h"
+#include "dbpool.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const long SpoolManager::CHECK_INTERVAL = 5;
+const long SpoolManager::SCAN_INTERVAL = 600;
+const long SpoolManager::MIN_IDLE = 60;
+const size_t SpoolManager::EVICT_BATCH = 4096;
+
+set<string> SpoolManager::ready;
+InfernoConf SpoolManager::conf;
+bool SpoolManager::started = false;
+pthread_mutex_t SpoolManager::lock = PTHREAD_MUTEX_INITIALIZER;
+
+int SpoolManager::checkAndCreateDir(const char* path) {
+	struct stat st;
+	int stat_;
+	if ((stat_ = stat(path, &st))) { // If path does not exist, create it
+		if (mkdir(path, 0700)) {
+			if (errno != EEXIST) {
+				perror("mkdir");
+				return 1;
+			}
+			stat_ = 1;
+		}
+	}
+
+	if (stat_ > 0 && (stat_ = stat(path, &st))) {
+		perror("stat");
+		return 1;
+	}
+
+	if (!stat_) { // Path exists
+		if (!S_ISDIR(st.st_mode)) { // If path is not a directory
+			Logger::error("The spool directory path exists but is not a directory. Bailing out...");
+			return 1;
+		}
+		if (access(path, F_OK)) { // Path is a dir. Check access rights.
+			perror("access");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Sets up the spool directory of the given configuration, unless done
+ * already by this process, and starts the evictor on first use if spool
+ * limits are configured.
+ *
+ * Returns: 0 on success, 1 on error
+ */
+int SpoolManager::init(const InfernoConf& iConf) {
+	string path = iConf.getDirectory();
+	int ret = 0;
+
+	pthread_mutex_lock(&lock);
+	// the fan-out directories are created as files are spooled to them
+	if (!ready.count(path) && !(ret = checkAndCreateDir(path.c_str())))
+		ready.insert(path);
+
+	if (!ret && !started && (iConf.getSpoolHigh() > 0 || iConf.getSpoolMaxAge() > 0)) {
+		pthread_t tid;
+		conf = iConf;
+		if (pthread_create(&tid, NULL, run, NULL)) {
+			Logger::error("pthread_create");
+		} else {
+			pthread_detach(tid);
+			started = true;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+/**
+ * Creates the missing directories leading to the given spool path.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int SpoolManager::makeParents(const string& path) {
+	size_t pos = path.find_last_of('/');
+
+	if (pos == string::npos || pos == 0)
+		return 0;
+
+	string dir = path.substr(0, pos);
+	if (!mkdir(dir.c_str(), 0700) || errno == EEXIST)
+		return 0;
+	if (errno != ENOENT || makeParents(dir) || (mkdir(dir.c_str(), 0700) && errno != EEXIST)) {
+		Logger::error("mkdir(%s): %s", dir.c_str(), strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Returns the bytes in use on the file system of the given directory.
+ */
+unsigned long long SpoolManager::usedBytes(const string& dir) {
+	struct statvfs st;
+
+	if (statvfs(dir.c_str(), &st))
+		return 0;
+	return (unsigned long long)(st.f_blocks - st.f_bfree) * st.f_frsize;
+}
+
+/**
+ * Adds up the spool files under the given directory, collecting those
+ * unused for longer than the maximum age, and the least recently used
+ * others (a max-heap of at most EVICT_BATCH files).
+ */
+void SpoolManager::walk(const string& dir, int depth, time_t now, const InfernoConf& iConf,
+		off_t& total, vector<File>& oldest, vector<File>& expired) {
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+
+	if (!(d = opendir(dir.c_str())))
+		return;
+
+	while ((de = readdir(d))) {
+		string name = de->d_name;
+		File f;
+
+		// dot files are ours, or temporary ones of spool writers
+		if (name[0] == '.' || lstat((dir + "/" + name).c_str(), &st))
+			continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			if (depth < InfernoConf::MAX_SPOOL_LEVELS)
+				walk(dir + "/" + name, depth + 1, now, iConf, total, oldest, expired);
+			continue;
+		}
+		// partial images and the like are Sead's to remove
+		if (!S_ISREG(st.st_mode) || name.length() != 32 || name.find_first_not_of("0123456789abcdef") != string::npos)
+			continue;
+
+		total += st.st_size;
+		f.path = dir + "/" + name;
+		f.hash = name;
+		f.size = st.st_size;
+		f.used = max(st.st_atime, st.st_mtime);
+		if (now - f.used < MIN_IDLE)
+			continue;
+
+		if (iConf.getSpoolMaxAge() > 0 && now - f.used > iConf.getSpoolMaxAge()) {
+			if (expired.size() < EVICT_BATCH)
+				expired.push_back(f);
+			continue;
+		}
+
+		oldest.push_back(f);
+		push_heap(oldest.begin(), oldest.end());
+		if (oldest.size() > EVICT_BATCH) {
+			pop_heap(oldest.begin(), oldest.end());
+			oldest.pop_back();
+		}
+	}
+	closedir(d);
+}
+
+/**
+ * Scans the whole spool.
+ *
+ * Returns: the bytes spooled
+ */
+off_t SpoolManager::scan(const InfernoConf& iConf, vector<File>& oldest, vector<File>& expired) {
+	off_t total = 0;
+
+	walk(iConf.getDirectory(), 0, time(NULL), iConf, total, oldest, expired);
+	sort_heap(oldest.begin(), oldest.end());
+	return total;
+}
+
+/**
+ * Evicts the given files, least recently used first, until 'excess' bytes
+ * are freed (all of them, for a negative 'excess'). The files of entries
+ * in progress are skipped.
+ *
+ * Returns: the bytes freed
+ */
+off_t SpoolManager::evict(const InfernoConf& iConf, vector<File>& files, off_t excess) {
+	map<string, UrlRecord> records;
+	set<string> hashes;
+	DbCache *cache;
+	off_t freed = 0;
+	int evicted = 0;
+
+	if (files.empty())
+		return 0;
+
+	for (vector<File>::iterator it = files.begin(); it != files.end(); it++)
+		hashes.insert(it->hash);
+
+	if (!(cache = DbPool::checkout(iConf)))
+		return 0;
+	if (cache->lookupUrlRecords(hashes, records) < 0) {
+		DbPool::checkin(cache);
+		return 0;
+	}
+	DbPool::checkin(cache);
+
+	for (vector<File>::iterator it = files.begin(); it != files.end() && (excess < 0 || freed < excess); it++) {
+		map<string, UrlRecord>::iterator rit = records.find(it->hash);
+
+		if (rit != records.end() && rit->second.status != InfernoConf::STATUS_DONE &&
+				rit->second.status != InfernoConf::STATUS_FAILURE)
+			continue;
+		if (unlink(it->path.c_str()))
+			continue;
+		freed += it->size;
+		evicted++;
+	}
+
+	if (evicted)
+		Logger::debug("Evicted %d spool files (%ld bytes)", evicted, (long)freed);
+	return freed;
+}
+
+void* SpoolManager::run(void *arg) {
+	InfernoConf iConf;
+	unsigned long long fs_used = 0;
+	off_t scanned = 0, high, low;
+	time_t last_scan = 0;
+	bool leader = false;
+	int fd = -1;
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	iConf = conf;
+	pthread_mutex_unlock(&lock);
+
+	string dir = iConf.getDirectory();
+	string lockPath = dir + "/.evictor";
+	high = iConf.getSpoolHigh();
+	low = (iConf.getSpoolLow() > 0 && iConf.getSpoolLow() < high) ? iConf.getSpoolLow() : high;
+
+	while (true) {
+		sleep(CHECK_INTERVAL);
+
+		// one process of the host evicts; the others stand by in case it exits
+		if (!leader) {
+			if (fd < 0 && (fd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0666)) < 0)
+				continue;
+			if (flock(fd, LOCK_EX | LOCK_NB))
+				continue;
+			leader = true;
+			Logger::info("Managing spool %s from process %d", dir.c_str(), (int)getpid());
+		}
+
+		// the spool has grown by at most as much as its file system since
+		// the last scan
+		unsigned long long used = usedBytes(dir);
+		off_t estimate = scanned + ((used > fs_used) ? (off_t)(used - fs_used) : 0);
+		time_t now = time(NULL);
+
+		if (now - last_scan < SCAN_INTERVAL && (high <= 0 || estimate <= high))
+			continue;
+
+		vector<File> oldest, expired;
+		off_t total = scan(iConf, oldest, expired);
+
+		total -= evict(iConf, expired, -1);
+		if (high > 0 && total > high)
+			total -= evict(iConf, oldest, total - low);
+
+		scanned = total;
+		fs_used = usedBytes(dir);
+		last_scan = now;
+	}
+	return NULL;
+}
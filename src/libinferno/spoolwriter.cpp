@@ -0,0 +1,232 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "spoolwriter.h"
+#include "spoolmanager.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const size_t SpoolWriter::BUFSIZE = 64 * 1024;
+const size_t SpoolWriter::ALIGNMENT = 4096;
+
+SpoolWriter::SpoolWriter(const string& path) :
+	path(path), fd(-1), buf(NULL), buffered(0), written(0), published(false) {}
+
+SpoolWriter::~SpoolWriter() {
+	discard();
+}
+
+/**
+ * Creates the file backing the spool writer, in the directory of the final
+ * path. Returns 0 on success, -1 on failure.
+ */
+int SpoolWriter::open() {
+	void *mem;
+
+	if (fd >= 0 || path.empty())
+		return -1;
+
+#ifdef O_TMPFILE
+	string dir = path.substr(0, path.find_last_of('/') + 1);
+	const char *where = dir.empty() ? "." : dir.c_str();
+	// the fan-out directories of the spool are created on first use
+	if ((fd = ::open(where, O_TMPFILE | O_RDWR, 0644)) < 0 && errno == ENOENT && !SpoolManager::makeParents(path))
+		fd = ::open(where, O_TMPFILE | O_RDWR, 0644);
+	if (fd < 0)
+		Logger::debug("O_TMPFILE not supported for %s; using a temporary file", dir.c_str());
+#endif
+
+	if (fd < 0) {
+		char *tmpl = new char[path.size() + 8];
+		sprintf(tmpl, "%s.XXXXXX", path.c_str());
+		if ((fd = mkstemp(tmpl)) < 0 && errno == ENOENT && !SpoolManager::makeParents(path)) {
+			sprintf(tmpl, "%s.XXXXXX", path.c_str());
+			fd = mkstemp(tmpl);
+		}
+		if (fd < 0) {
+			Logger::error("mkstemp(%s): %s", tmpl, strerror(errno));
+			delete[] tmpl;
+			return -1;
+		}
+		fchmod(fd, 0644);
+		tmp_path = tmpl;
+		delete[] tmpl;
+	}
+
+	if (posix_memalign(&mem, ALIGNMENT, BUFSIZE)) {
+		Logger::error("posix_memalign");
+		discard();
+		return -1;
+	}
+	buf = (char *)mem;
+	return 0;
+}
+
+int SpoolWriter::writeOut(const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = ::write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			Logger::error("write(%s): %s", path.c_str(), strerror(errno));
+			return -1;
+		}
+		data += n;
+		len -= n;
+		written += n;
+	}
+	return 0;
+}
+
+/**
+ * Buffers len bytes of data, writing out whole buffers as they fill up.
+ * Returns the number of bytes accepted, which is less than len on error.
+ */
+size_t SpoolWriter::write(const char *data, size_t len) {
+	size_t done = 0;
+
+	if (fd < 0 || !buf)
+		return 0;
+
+	while (done < len) {
+		// large writes to an empty buffer go straight to the file
+		if (!buffered && len - done >= BUFSIZE) {
+			size_t n = (len - done) - (len - done) % BUFSIZE;
+			if (writeOut(data + done, n))
+				return done;
+			done += n;
+			continue;
+		}
+
+		size_t n = BUFSIZE - buffered;
+		if (n > len - done)
+			n = len - done;
+		memcpy(buf + buffered, data + done, n);
+		buffered += n;
+		done += n;
+
+		if (buffered == BUFSIZE && flush())
+			return done - n;
+	}
+	return done;
+}
+
+/**
+ * Reserves disk space for a file of len bytes, without changing its size.
+ */
+void SpoolWriter::preallocate(off_t len) {
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (fd >= 0 && len > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, len) && errno != EOPNOTSUPP)
+		Logger::debug("fallocate(%s): %s", path.c_str(), strerror(errno));
+#else
+	(void)len;
+#endif
+}
+
+int SpoolWriter::flush() {
+	if (fd < 0)
+		return -1;
+	if (buffered && writeOut(buf, buffered))
+		return -1;
+	buffered = 0;
+	return 0;
+}
+
+int SpoolWriter::link() {
+	if (tmp_path.empty()) {
+#ifdef O_TMPFILE
+		char proc[64];
+		snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+		if (!linkat(AT_FDCWD, proc, AT_FDCWD, path.c_str(), AT_SYMLINK_FOLLOW))
+			return 0;
+		if (errno != EEXIST) {
+			Logger::error("linkat(%s): %s", path.c_str(), strerror(errno));
+			return -1;
+		}
+
+		// the final path exists; link under a temporary name and move that
+		// over it instead
+		char tmp[64];
+		snprintf(tmp, sizeof(tmp), ".%d.%d", (int)getpid(), fd);
+		tmp_path = path + tmp;
+		unlink(tmp_path.c_str());
+		if (linkat(AT_FDCWD, proc, AT_FDCWD, tmp_path.c_str(), AT_SYMLINK_FOLLOW)) {
+			Logger::error("linkat(%s): %s", tmp_path.c_str(), strerror(errno));
+			tmp_path.clear();
+			return -1;
+		}
+#else
+		return -1;
+#endif
+	}
+
+	if (rename(tmp_path.c_str(), path.c_str())) {
+		Logger::error("rename(%s): %s", path.c_str(), strerror(errno));
+		return -1;
+	}
+	tmp_path.clear();
+	return 0;
+}
+
+/**
+ * Writes out any buffered data and makes the file visible at its final
+ * path, replacing any previous version. Returns 0 on success, -1 on
+ * failure, in which case the data is discarded.
+ */
+int SpoolWriter::publish() {
+	if (published)
+		return 0;
+	if (flush() || link()) {
+		discard();
+		return -1;
+	}
+	published = true;
+	discard();
+	return 0;
+}
+
+/**
+ * Drops the file unless published, and releases all resources.
+ */
+void SpoolWriter::discard() {
+	if (!published && !tmp_path.empty())
+		unlink(tmp_path.c_str());
+	tmp_path.clear();
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	if (buf)
+		free(buf);
+	buf = NULL;
+	buffered = 0;
+}
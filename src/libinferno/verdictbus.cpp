@@ -0,0 +1,134 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef SYS_futex
+#include <linux/futex.h>
+#endif
+
+#include "verdictbus.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const size_t VerdictBus::WORDS = 4096;
+const long VerdictBus::FALLBACK_POLLS = 5;
+
+volatile unsigned int *VerdictBus::table = NULL;
+bool VerdictBus::attached = false;
+pthread_mutex_t VerdictBus::lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the word of the given entry, mapping the table on first use, or
+ * NULL if the table is not available.
+ */
+volatile unsigned int* VerdictBus::word(const InfernoConf& conf, const string& hash) {
+	pthread_mutex_lock(&lock);
+	if (!attached) {
+#ifdef SYS_futex
+		string path = conf.getDirectory() + "/.verdicts";
+		size_t size = WORDS * sizeof(unsigned int);
+		struct stat st;
+		void *map;
+		int fd;
+
+		if ((fd = open(path.c_str(), O_RDWR | O_CREAT, 0600)) < 0) {
+			Logger::warn("Verdict notifications unavailable: cannot open %s", path.c_str());
+		} else {
+			// a file of any process's making is zero-filled and as large
+			if ((fstat(fd, &st) || (size_t)st.st_size < size) && ftruncate(fd, size))
+				Logger::warn("Verdict notifications unavailable: cannot size %s", path.c_str());
+			else if ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+				Logger::warn("Verdict notifications unavailable: cannot map %s", path.c_str());
+			else
+				table = (volatile unsigned int *)map;
+			close(fd);
+		}
+#endif
+		attached = true;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!table)
+		return NULL;
+	return &table[strtoul(hash.substr(0, 8).c_str(), NULL, 16) % WORDS];
+}
+
+/**
+ * Returns the number of verdicts published so far on the given entry (and
+ * those sharing its word). Read it before looking the entry up, and hand
+ * it to wait() afterwards, so that no verdict slips in between.
+ */
+unsigned int VerdictBus::sequence(const InfernoConf& conf, const string& hash) {
+	volatile unsigned int *w = word(conf, hash);
+
+	return w ? *w : 0;
+}
+
+/**
+ * Wakes up the parties waiting for a verdict on the given entry.
+ */
+void VerdictBus::publish(const InfernoConf& conf, const string& hash) {
+	volatile unsigned int *w = word(conf, hash);
+
+	if (!w)
+		return;
+
+	__sync_fetch_and_add(w, 1);
+#ifdef SYS_futex
+	syscall(SYS_futex, w, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * Waits for a verdict on the given entry to be published after 'seen' was
+ * read, for a few poll intervals
+ * at most. Without the bus, waits for a single poll interval.
+ */
+void VerdictBus::wait(const InfernoConf& conf, unsigned int seen, const string& hash) {
+	volatile unsigned int *w = word(conf, hash);
+
+	if (!w) {
+		usleep(conf.getPollInterval());
+		return;
+	}
+
+#ifdef SYS_futex
+	long usecs = conf.getPollInterval() * FALLBACK_POLLS;
+	struct timespec ts;
+
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = (usecs % 1000000) * 1000;
+	// returns at once if a verdict came in since
+	syscall(SYS_futex, w, FUTEX_WAIT, seen, &ts, NULL, 0);
+#endif
+}
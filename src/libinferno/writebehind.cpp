@@ -0,0 +1,153 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mysql.h>
+
+#include "writebehind.h"
+#include "fetchstats.h"
+#include "mysqlcache.h"
+#include "logger.h"
+#include "config.h"
+
+using namespace std;
+
+const double WriteBehind::FLUSH_DELAY = 1.0;
+const size_t WriteBehind::MAX_QUEUE = 256;
+
+map<string, WriteBehind::Change> WriteBehind::queue;
+set<string> WriteBehind::flushing;
+InfernoConf WriteBehind::conf;
+bool WriteBehind::started = false;
+pthread_mutex_t WriteBehind::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t WriteBehind::wakeup = PTHREAD_COND_INITIALIZER;
+pthread_cond_t WriteBehind::flushed = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Queues a change to an entry in progress, merging it with those already
+ * queued for the entry, and starts the background flusher on first use.
+ */
+void WriteBehind::defer(const InfernoConf& iConf, const string& hash, const Change& change) {
+	pthread_mutex_lock(&lock);
+	conf = iConf;
+
+	if (!started) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, run, NULL)) {
+			Logger::error("pthread_create");
+		} else {
+			pthread_detach(tid);
+			started = true;
+		}
+	}
+
+	map<string, Change>::iterator it = queue.find(hash);
+	if (it == queue.end()) {
+		it = queue.insert(make_pair(hash, Change())).first;
+		it->second.queued = FetchStats::now();
+	}
+	if (change.status >= 0)
+		it->second.status = change.status;
+	if (change.decision >= 0)
+		it->second.decision = change.decision;
+	if (change.has_ctype) {
+		it->second.has_ctype = true;
+		it->second.ctype = change.ctype;
+	}
+
+	if (queue.size() >= MAX_QUEUE)
+		pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Removes and returns the changes queued for an entry, for the caller to
+ * write them along with a change of its own. Changes being flushed are
+ * waited for, so that they never land after the caller's.
+ */
+WriteBehind::Change WriteBehind::take(const string& hash) {
+	Change change;
+
+	pthread_mutex_lock(&lock);
+	while (flushing.count(hash))
+		pthread_cond_wait(&flushed, &lock);
+
+	map<string, Change>::iterator it = queue.find(hash);
+	if (it != queue.end()) {
+		change = it->second;
+		queue.erase(it);
+	}
+	pthread_mutex_unlock(&lock);
+	return change;
+}
+
+void* WriteBehind::run(void *arg) {
+	MysqlCache *cache = NULL;
+	(void)arg;
+
+	mysql_thread_init();
+
+	pthread_mutex_lock(&lock);
+	while (true) {
+		double now = FetchStats::now();
+		bool all = (queue.size() >= MAX_QUEUE);
+		map<string, Change> batch;
+
+		for (map<string, Change>::iterator it = queue.begin(); it != queue.end(); ) {
+			if (all || now - it->second.queued >= FLUSH_DELAY) {
+				batch.insert(*it);
+				flushing.insert(it->first);
+				queue.erase(it++);
+			} else {
+				it++;
+			}
+		}
+
+		if (batch.empty()) {
+			struct timespec ts;
+			double until = now + FLUSH_DELAY / 2;
+			ts.tv_sec = (time_t)until;
+			ts.tv_nsec = (long)((until - ts.tv_sec) * 1000000000.0);
+			pthread_cond_timedwait(&wakeup, &lock, &ts);
+			continue;
+		}
+
+		InfernoConf iConf = conf;
+		pthread_mutex_unlock(&lock);
+
+		if (!cache) {
+			cache = new MysqlCache();
+			if (cache->init(iConf)) {
+				delete cache;
+				cache = NULL;
+			}
+		} else {
+			cache->setInfernoConf(iConf);
+		}
+		// the changes are of entries in progress, and are lost with them
+		if (!cache || cache->applyChanges(batch) < 0)
+			Logger::debug("Dropped %d queued cache updates", (int)batch.size());
+
+		pthread_mutex_lock(&lock);
+		flushing.clear();
+		pthread_cond_broadcast(&flushed);
+	}
+	return NULL;
+}
@@ -59,10 +59,11 @@ SeadClient::SCResult SeadClient::init() {
 	return SCL_OK;
 }
 
-int SeadClient::classifyUri(const string& path, const string& type, const InfernoConf& iConf) {
+int SeadClient::classifyUri(const string& path, const string& type, const InfernoConf& iConf, bool partial) {
 	int ret;
-	// construct request string
-	string req_buf = "CLASSIFY " + path + " OFTYPE " + type + "\n";
+	// construct request string; partial requests refer to the first scans
+	// of an image still being fetched
+	string req_buf = (partial ? "PARTIAL " : "CLASSIFY ") + path + " OFTYPE " + type + "\n";
 	req_buf.append(iConf.toString());
 	req_buf.append("\r\n");
 	
@@ -19,6 +19,8 @@
  * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -27,6 +29,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <mysql.h>
+
 extern "C"
 {
 #include <c-icap.h>
@@ -37,6 +41,8 @@ extern "C"
 #include "multifetch.h"
 #include "htmlparse.h"
 #include "dbcache.h"
+#include "dbpool.h"
+#include "reaper.h"
 #include "logger.h"
 #include "config.h"
 
@@ -59,8 +65,19 @@ int cfg_get_conn_timeo(char *directive, char **argv, void *setdata);
 int cfg_get_speed_lim(char *directive, char **argv, void *setdata);
 int cfg_get_max_xfers(char *directive, char **argv, void *setdata);
 int cfg_get_poll_ival(char *directive, char **argv, void *setdata);
+int cfg_get_fail_backoff(char *directive, char **argv, void *setdata);
+int cfg_get_dns_ttl(char *directive, char **argv, void *setdata);
+int cfg_get_css_ttl(char *directive, char **argv, void *setdata);
+int cfg_get_hedging(char *directive, char **argv, void *setdata);
+int cfg_get_min_width(char *directive, char **argv, void *setdata);
+int cfg_get_partial(char *directive, char **argv, void *setdata);
+int cfg_get_crawl_ahead(char *directive, char **argv, void *setdata);
 int cfg_get_cachedir(char *directive, char **argv, void *setdata);
+int cfg_get_spool_limits(char *directive, char **argv, void *setdata);
+int cfg_get_spool_fanout(char *directive, char **argv, void *setdata);
+int cfg_get_cache_retention(char *directive, char **argv, void *setdata);
 int cfg_get_cache_db(char *directive, char **argv, void *setdata);
+int cfg_get_cache_backend(char *directive, char **argv, void *setdata);
 
 const char *protos[] = {"", "http", "https", "ftp", NULL};
 enum proto {UNKNOWN=0, HTTP, HTTPS, FTP};
@@ -73,8 +90,19 @@ const static struct ci_conf_entry configuration[] = {
 	{(char*)"LowSpeedLimit", &iConf, cfg_get_speed_lim, NULL},
 	{(char*)"MaxConcurrentTransfers", &iConf, cfg_get_max_xfers, NULL},
 	{(char*)"PollInterval", &iConf, cfg_get_poll_ival, NULL},
+	{(char*)"FailureBackoff", &iConf, cfg_get_fail_backoff, NULL},
+	{(char*)"DNSCacheTTL", &iConf, cfg_get_dns_ttl, NULL},
+	{(char*)"StylesheetCacheTTL", &iConf, cfg_get_css_ttl, NULL},
+	{(char*)"Hedging", &iConf, cfg_get_hedging, NULL},
+	{(char*)"MinImageWidth", &iConf, cfg_get_min_width, NULL},
+	{(char*)"PartialClassification", &iConf, cfg_get_partial, NULL},
+	{(char*)"CrawlAhead", &iConf, cfg_get_crawl_ahead, NULL},
 	{(char*)"CacheDir", &iConf, cfg_get_cachedir, NULL},
+	{(char*)"SpoolLimits", &iConf, cfg_get_spool_limits, NULL},
+	{(char*)"SpoolFanout", &iConf, cfg_get_spool_fanout, NULL},
+	{(char*)"CacheRetention", &iConf, cfg_get_cache_retention, NULL},
 	{(char*)"CacheDB", &iConf, cfg_get_cache_db, NULL},
+	{(char*)"CacheBackend", &iConf, cfg_get_cache_backend, NULL},
 	{NULL, NULL, NULL, NULL}
 };
 
@@ -166,6 +194,88 @@ int cfg_get_poll_ival(char *directive, char **argv, void *setdata) {
 	return 1;
 }
 
+int cfg_get_fail_backoff(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !argv[1] || !setdata)
+		return 0;
+	long backoff = atol(argv[0]), max = atol(argv[1]);
+	if (backoff < 0 || max < backoff)
+		return 0;
+	((InfernoConf *)setdata)->setFailureBackoff(backoff);
+	((InfernoConf *)setdata)->setFailureBackoffMax(max);
+	return 1;
+}
+
+int cfg_get_dns_ttl(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !setdata)
+		return 0;
+	long ttl = atol(argv[0]);
+	if (ttl < 0)
+		return 0;
+	((InfernoConf *)setdata)->setDnsCacheTTL(ttl);
+	return 1;
+}
+
+int cfg_get_css_ttl(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !setdata)
+		return 0;
+	long ttl = atol(argv[0]);
+	if (ttl < 0)
+		return 0;
+	((InfernoConf *)setdata)->setStylesheetTTL(ttl);
+	return 1;
+}
+
+int cfg_get_hedging(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !argv[1] || !setdata)
+		return 0;
+	// both the percentile and the share of hedged transfers are percentages
+	long percentile = atol(argv[0]), ratio = atol(argv[1]);
+	if (percentile < 0 || percentile > 100 || ratio < 0 || ratio > 100)
+		return 0;
+	((InfernoConf *)setdata)->setHedgePercentile(percentile);
+	((InfernoConf *)setdata)->setHedgeRatio(ratio);
+	return 1;
+}
+
+int cfg_get_min_width(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !setdata)
+		return 0;
+	long width = atol(argv[0]);
+	if (width < 0)
+		return 0;
+	((InfernoConf *)setdata)->setMinImageWidth(width);
+	return 1;
+}
+
+int cfg_get_partial(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !argv[1] || !setdata)
+		return 0;
+	long scans = atol(argv[0]), confidence = atol(argv[1]);
+	if (scans < 0 || confidence < 0 || confidence > 100)
+		return 0;
+	((InfernoConf *)setdata)->setPartialScans(scans);
+	((InfernoConf *)setdata)->setPartialConfidence(confidence);
+	return 1;
+}
+
+int cfg_get_crawl_ahead(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !argv[1] || !setdata)
+		return 0;
+	long links = atol(argv[0]), rate = atol(argv[1]);
+	if (links < 0 || rate < 0)
+		return 0;
+	((InfernoConf *)setdata)->setPrefetchLinks(links);
+	((InfernoConf *)setdata)->setPrefetchRate(rate);
+	return 1;
+}
+
 int cfg_get_cachedir(char *directive, char **argv, void *setdata) {
 	(void)directive;
 	if (!argv || !argv[0] || !setdata)
@@ -174,6 +284,71 @@ int cfg_get_cachedir(char *directive, char **argv, void *setdata) {
 	return 1;
 }
 
+/**
+ * Parses a whole argument of the given directive as a number between 0 and
+ * 'max', logging why it is not one.
+ *
+ * Returns: 1 on success, 0 otherwise
+ */
+static int cfg_parse_count(const char *directive, const char *arg, long max, long& val) {
+	char *end;
+
+	errno = 0;
+	val = strtol(arg, &end, 10);
+	if (end == arg || *end || errno || val < 0 || val > max) {
+		Logger::error("%s: '%s' is not a number between 0 and %ld", directive, arg, max);
+		return 0;
+	}
+	return 1;
+}
+
+int cfg_get_spool_limits(char *directive, char **argv, void *setdata) {
+	long high, low = 0, age = 0;
+
+	if (!argv || !argv[0] || !setdata)
+		return 0;
+	// watermarks are given in megabytes; the low one defaults to 80% of the high one
+	if (!cfg_parse_count(directive, argv[0], LONG_MAX / 1048576L, high) ||
+			(argv[1] && !cfg_parse_count(directive, argv[1], LONG_MAX / 1048576L, low)) ||
+			(argv[1] && argv[2] && !cfg_parse_count(directive, argv[2], LONG_MAX, age)))
+		return 0;
+	if (argv[1] && high && low > high) {
+		Logger::error("%s: the low watermark (%ld) is above the high one (%ld)", directive, low, high);
+		return 0;
+	}
+	high *= 1048576L;
+	((InfernoConf *)setdata)->setSpoolHigh(high);
+	((InfernoConf *)setdata)->setSpoolLow((argv[1]) ? low * 1048576L : high / 5 * 4);
+	if (argv[1] && argv[2])
+		((InfernoConf *)setdata)->setSpoolMaxAge(age);
+	return 1;
+}
+
+int cfg_get_spool_fanout(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !argv[1] || !setdata)
+		return 0;
+	long levels = atol(argv[0]), digits = atol(argv[1]);
+	if (levels < 1 || levels > InfernoConf::MAX_SPOOL_LEVELS || digits < 1 || digits > InfernoConf::MAX_SPOOL_DIGITS)
+		return 0;
+	((InfernoConf *)setdata)->setSpoolLevels(levels);
+	((InfernoConf *)setdata)->setSpoolDigits(digits);
+	return 1;
+}
+
+int cfg_get_cache_retention(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !setdata)
+		return 0;
+	// the reaper goes through 100 entries or files per second by default
+	long age = atol(argv[0]), rate = (argv[1]) ? atol(argv[1]) : 100;
+	if (age < 0 || rate < 0)
+		return 0;
+	((InfernoConf *)setdata)->setCacheRetention(age);
+	((InfernoConf *)setdata)->setReapRate(rate);
+	return 1;
+}
+
 int cfg_get_cache_db(char *directive, char **argv, void *setdata) {
 	(void)directive;
 	if (!argv || !argv[0] || !argv[1] || !argv[2] || !argv[3] || !argv[4])
@@ -186,11 +361,33 @@ int cfg_get_cache_db(char *directive, char **argv, void *setdata) {
 	return 1;
 }
 
+int cfg_get_cache_backend(char *directive, char **argv, void *setdata) {
+	(void)directive;
+	if (!argv || !argv[0] || !setdata)
+		return 0;
+	if (!strcasecmp(argv[0], "mysql")) {
+		((InfernoConf *)setdata)->setCacheBackend(InfernoConf::BACKEND_MYSQL);
+		return 1;
+	}
+	if (strcasecmp(argv[0], "local"))
+		return 0;
+	((InfernoConf *)setdata)->setCacheBackend(InfernoConf::BACKEND_LOCAL);
+	if (argv[1]) {
+		((InfernoConf *)setdata)->setLocalStore(argv[1]);
+		if (argv[2])
+			((InfernoConf *)setdata)->setLocalSlots(atol(argv[2]));
+	}
+	return 1;
+}
+
 void inferno_close_service() {
 	Logger::info("Releasing InFeRno module...");
-	DbCache cache;
-	if (!cache.init(iConf))
-		cache.fixCache();
+	DbCache *cache = DbPool::checkout(iConf);
+	if (cache) {
+		cache->fixCache();
+		DbPool::checkin(cache);
+	}
+	DbPool::clear();
 }
 
 int inferno_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf *server_conf) {
@@ -299,6 +496,10 @@ int inferno_check_preview(char *preview_data, int preview_data_len, ci_request_t
 
 	Logger::debug("Filtering mode: %d", f_mode);
 	Multifetch multifetch(iConf);
+	// c-icap forks the children serving requests after init_service, and
+	// has no per-child hook for services; the first request of each child
+	// starts its reaper, and this is a no-op for every later one
+	Reaper::init(iConf);
 
 	if ((req_header = ci_http_request_headers(req)) == NULL ||
 			get_http_url(req_header, cur_site, cur_uri)) {
@@ -344,6 +545,9 @@ int inferno_check_preview(char *preview_data, int preview_data_len, ci_request_t
 			Logger::info("image was classified as BIKINI/PORN. Forwarding blurred version to the user");
 			struct stat st;
 			string path = iConf.computePathFromHash(cur_uri_hash);
+			// spooled before the fan-out was changed, and not rehomed since
+			if (stat(path.c_str(), &st))
+				path = iConf.computeLegacyPathFromHash(cur_uri_hash);
 			if (!stat(path.c_str(), &st)) {
 				FILE* fd = fopen(path.c_str(), "rb");
 				if (fd) {
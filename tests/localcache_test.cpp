@@ -0,0 +1,167 @@
+/*
+ * This file is part of InFeRno.
+ *
+ * Copyright (C) 2011:
+ *    Nikos Ntarmos <ntarmos@cs.uoi.gr>,
+ *    Sotirios Karavarsamis <s.karavarsamis@gmail.com>
+ *
+ * InFeRno is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * InFeRno is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with InFeRno. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "dbcache.h"
+#include "infernoconf.h"
+#include "config.h"
+
+using namespace std;
+
+/**
+ * Round trip through the embedded verdict store, on a store file of its
+ * own: claims, verdicts, lookups, removals that make the table compact
+ * itself, renewal, reopening, and expiry. Exits with a non-zero status on the first
+ * check that fails.
+ */
+
+#define CAPACITY 100
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+} while (0)
+
+static string urlOf(int i) {
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "http://example.com/%d.jpg", i);
+	return buf;
+}
+
+static DbCache* openStore(const InfernoConf& conf) {
+	DbCache *cache = DbCache::create(conf);
+
+	CHECK(cache != NULL);
+	CHECK(!cache->init(conf));
+	CHECK(cache->connect());
+	return cache;
+}
+
+/**
+ * Claims and classifies entry i, which must be new.
+ */
+static string classify(DbCache *cache, int i) {
+	string hash;
+
+	CHECK(cache->insertUrlEntry(urlOf(i), hash) == 1);
+	CHECK(cache->updateUrlClassification(hash, (i % 2) ? InfernoConf::CLASS_PORN : InfernoConf::CLASS_BENIGN));
+	CHECK(cache->updateUrlStatus(hash, InfernoConf::STATUS_DONE));
+	return hash;
+}
+
+/**
+ * Checks that entries [from, to) hold their verdicts.
+ */
+static void checkVerdicts(DbCache *cache, int from, int to) {
+	for (int i = from; i < to; i++) {
+		string hash = DbCache::hashUrl(urlOf(i));
+		UrlRecord record;
+
+		CHECK(cache->lookupUrlRecord(hash, record) == 1);
+		CHECK(record.status == InfernoConf::STATUS_DONE);
+		CHECK(record.decision == ((i % 2) ? InfernoConf::CLASS_PORN : InfernoConf::CLASS_BENIGN));
+	}
+}
+
+int main() {
+	char dir[] = "/tmp/localcache_test.XXXXXX";
+	InfernoConf conf;
+	DbCache *cache;
+	UrlRecord record;
+	string hash;
+	bool more;
+	int expired = 0;
+
+	CHECK(mkdtemp(dir) != NULL);
+	conf.setDirectory(dir);
+	conf.setCacheBackend(InfernoConf::BACKEND_LOCAL);
+	conf.setLocalStore(string(dir) + "/store");
+	conf.setLocalSlots(CAPACITY);
+	cache = openStore(conf);
+
+	// a claim is made once; the entry is in progress until its verdict
+	CHECK(cache->insertUrlEntry(urlOf(0), hash) == 1);
+	CHECK(cache->insertUrlEntry(urlOf(0), hash) == -1);
+	CHECK(cache->lookupUrlRecord(hash, record) == 1);
+	CHECK(record.status == InfernoConf::STATUS_FETCHING);
+	CHECK(cache->removeUrlEntry(hash) == 1);
+	CHECK(cache->lookupUrlRecord(hash, record) == 0);
+
+	// entries given up on while in progress leave deleted slots behind;
+	// enough of them for the table to be compacted several times
+	for (int i = 0; i < CAPACITY / 2; i++)
+		classify(cache, i);
+	for (int round = 0, i = CAPACITY; round < 20; round++) {
+		vector<string> hashes(CAPACITY / 2);
+
+		for (size_t j = 0; j < hashes.size(); j++)
+			CHECK(cache->insertUrlEntry(urlOf(i++), hashes[j]) == 1);
+		for (size_t j = 0; j < hashes.size(); j++)
+			CHECK(cache->removeUrlEntry(hashes[j]) == 1);
+		for (size_t j = 0; j < hashes.size(); j++)
+			CHECK(cache->lookupUrlRecord(hashes[j], record) == 0);
+		checkVerdicts(cache, 0, CAPACITY / 2);
+	}
+
+	// the configured number of entries fits, and no more
+	for (int i = CAPACITY / 2; i < CAPACITY; i++)
+		classify(cache, i);
+	CHECK(cache->insertUrlEntry(urlOf(-1), hash) == 0);
+
+	// verdicts are renewed in place; entries in progress are not
+	CHECK(cache->renewUrlVerdict(DbCache::hashUrl(urlOf(0))) == 1);
+	CHECK(cache->renewUrlVerdict(DbCache::hashUrl(urlOf(-1))) == 0);
+
+	// the entries outlive the process that wrote them
+	cache->cleanup();
+	delete cache;
+	cache = openStore(conf);
+	checkVerdicts(cache, 0, CAPACITY);
+
+	// verdicts expire, however many calls it takes to go through the table
+	do {
+		int ret = cache->expireUrlEntries(-1, CAPACITY / 4, more);
+
+		CHECK(ret >= 0);
+		expired += ret;
+	} while (more);
+	CHECK(expired == CAPACITY);
+	for (int i = 0; i < CAPACITY; i++)
+		CHECK(cache->lookupUrlRecord(DbCache::hashUrl(urlOf(i)), record) == 0);
+
+	cache->cleanup();
+	delete cache;
+	unlink(conf.getLocalStore().c_str());
+	unlink((string(dir) + "/.verdicts").c_str());
+	rmdir(dir);
+
+	printf("localcache_test: OK\n");
+	return 0;
+}